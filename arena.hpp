@@ -0,0 +1,187 @@
+/**
+ * @file   arena.hpp
+ *
+ * @brief A memory arena for the objects a reader constructs, so that
+ * everything read in a batch is freed at once instead of object by
+ * object.
+ *
+ * Memory is handed out from large blocks by bumping a pointer and is
+ * only returned when the arena is released or destroyed, which also
+ * runs the destructors of the objects created in it (in reverse
+ * order).
+ *
+ * With C++17 the arena is a std::pmr::memory_resource, so pmr strings
+ * and containers (std::pmr::string, std::pmr::vector, ...) can take
+ * their storage from it too; objects created in it which use a
+ * polymorphic_allocator are given one for the arena.
+ */
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define SERIALIZE_HAVE_PMR 1
+#endif
+#endif
+
+class Arena
+#ifdef SERIALIZE_HAVE_PMR
+  : public std::pmr::memory_resource
+#endif
+{
+public:
+  /**
+   * @param block_size bytes to allocate from the heap at a time
+   */
+  explicit Arena(size_t block_size = 64 * 1024):
+    block_size(block_size), pos(nullptr), end(nullptr),
+    destructors(nullptr), allocated(0)
+  {
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  ~Arena()
+  {
+    release();
+  }
+
+  /**
+   * Uninitialized memory, valid until the arena is released.
+   *
+   * @param size number of bytes
+   * @param alignment required alignment, a power of two
+   */
+  void* allocate_bytes(size_t size, size_t alignment)
+  {
+    char* start = align(pos, alignment);
+    if (!pos || start > end || size > static_cast<size_t>(end - start))
+      {
+	add_block(size + alignment);
+	start = align(pos, alignment);
+      }
+    pos = start + size;
+    allocated += size;
+    return start;
+  }
+
+  /**
+   * Default-construct an object of type T in the arena. Its
+   * destructor is run when the arena is released; it must not be
+   * deleted.
+   *
+   * @return the new object
+   */
+  template <typename T>
+  T* create()
+  {
+    T* object = construct<T>(allocate_bytes(sizeof(T), alignof(T)));
+    if (!std::is_trivially_destructible<T>::value)
+      {
+	void* record = allocate_bytes(sizeof(destructor_record), alignof(destructor_record));
+	destructors = new (record) destructor_record{&destroy<T>, object, destructors};
+      }
+    return object;
+  }
+
+  /**
+   * Destroy every object created in the arena, most recent first, and
+   * free all memory.
+   */
+  void release()
+  {
+    for (destructor_record* d = destructors; d; d = d->next)
+      d->destroy(d->object);
+    destructors = nullptr;
+    blocks.clear();
+    pos = end = nullptr;
+    allocated = 0;
+  }
+
+  /**
+   * @return bytes handed out since the arena was created or released
+   */
+  size_t bytes_allocated() const
+  {
+    return allocated;
+  }
+
+private:
+  struct destructor_record
+  {
+    void (*destroy)(void*);	/**< calls the destructor of the object */
+    void* object;		/**< object to destroy */
+    destructor_record* next;	/**< record of the previous object */
+  };
+
+  template <typename T>
+  static void destroy(void* object)
+  {
+    static_cast<T*>(object)->~T();
+  }
+
+#ifdef SERIALIZE_HAVE_PMR
+  // uses-allocator construction: types with a polymorphic_allocator
+  // get one for this arena
+  template <typename T>
+  T* construct(void* memory)
+  {
+    T* object = static_cast<T*>(memory);
+    std::pmr::polymorphic_allocator<T>(this).construct(object);
+    return object;
+  }
+
+  virtual void* do_allocate(size_t bytes, size_t alignment)
+  {
+    return allocate_bytes(bytes, alignment);
+  }
+
+  virtual void do_deallocate(void*, size_t, size_t)
+  {
+  }
+
+  virtual bool do_is_equal(const std::pmr::memory_resource & other) const noexcept
+  {
+    return this == &other;
+  }
+#else
+  template <typename T>
+  T* construct(void* memory)
+  {
+    return new (memory) T;
+  }
+#endif
+
+  static char* align(char* p, size_t alignment)
+  {
+    uintptr_t address = reinterpret_cast<uintptr_t>(p);
+    return p + ((alignment - address % alignment) % alignment);
+  }
+
+  void add_block(size_t min_size)
+  {
+    size_t size = min_size > block_size ? min_size : block_size;
+    blocks.emplace_back(new char[size]);
+    pos = blocks.back().get();
+    end = pos + size;
+  }
+
+  size_t block_size;		/**< size of each block from the heap */
+  char* pos;			/**< next free byte in the current block */
+  char* end;			/**< end of the current block */
+  destructor_record* destructors; /**< objects to destroy, most recent first */
+  size_t allocated;		/**< bytes handed out */
+  std::vector<std::unique_ptr<char[]> > blocks; /**< memory from the heap */
+};
+
+#endif // ARENA_HPP
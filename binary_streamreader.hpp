@@ -4,25 +4,110 @@
  * @date   Tue Dec  4 17:39:19 2012
  *
  * @brief  Classes/methods to deserialize the binary data written by BinaryStreamWriter
- * Expected to be used for native data i.e. currently non-portable. Will be extended to portable also in next revision
+ * By default the data is native i.e. non-portable; with the binary_portable
+ * format option it can be read on hosts of any byte order and word size.
  */
 
 #ifndef BINARY_STREAMREADER_HPP
 #define BINARY_STREAMREADER_HPP
 #include "streamreader.hpp"
 #include "stl_serialize.hpp"
+#include "byte_order.hpp"
+#include "fixed_size.hpp"
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <type_traits>
 #include <string>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+/**
+ * Read-only view of `size()' elements of an arithmetic type stored
+ * contiguously in the data being read, eg. the characters of a string
+ * or the elements of a vector<double>. Nothing is copied; the view is
+ * only valid as long as the memory the reader was constructed from.
+ *
+ * The elements need not be aligned in the serialized data, so they
+ * are accessed through operator[] (which copies one element out).
+ * data() may be used directly only if aligned() is true.
+ */
+template <typename T>
+class array_view
+{
+  static_assert(is_bulk_serializable<T>::value,
+		"array_view requires an arithmetic element type");
+public:
+  array_view(): m_bytes(nullptr), m_size(0) { }
+
+  array_view(const char* bytes, size_t size): m_bytes(bytes), m_size(size) { }
+
+  size_t size() const { return m_size; }
+
+  bool empty() const { return m_size == 0; }
+
+  /** 
+   * @return the serialized elements as raw bytes
+   */
+  const char* bytes() const { return m_bytes; }
+
+  /** 
+   * @return true if the elements are suitably aligned to be accessed
+   * through data()
+   */
+  bool aligned() const
+  {
+    return reinterpret_cast<size_t>(m_bytes) % alignof(T) == 0;
+  }
+
+  const T* data() const { return reinterpret_cast<const T*>(m_bytes); }
+
+  T operator[](size_t i) const
+  {
+    T element;
+    std::memcpy(&element, m_bytes + i * sizeof(T), sizeof(T));
+    return element;
+  }
+
+private:
+  const char* m_bytes;		/**< first element in the serialized data */
+  size_t m_size;		/**< number of elements */
+};
 
 /**
  * Inherits from StreamReader; constructed from an input stream
  * Reads binary data from the stream into objects according to the predefined format
+ *
+ * Can also be constructed from a block of memory holding the data, in
+ * which case no istream is involved: every field is decoded by
+ * copying from the block after a single bounds check.
+ *
+ * Must be given the same BinaryFormat as the writer of the data.
  */
 class BinaryStreamReader: public StreamReader
 {
 public:
-  BinaryStreamReader(std::istream& m_stream): StreamReader(m_stream) {
+  BinaryStreamReader(std::istream& m_stream, BinaryFormat format = binary_native):
+    StreamReader(m_stream), format_flags(format),
+    in_begin(nullptr), in_pos(nullptr), in_end(nullptr) {
+  }
+
+  /**
+   * Reads from `size' bytes starting at `data', eg. a network buffer
+   * or a vector filled by BinaryStreamWriter. The memory is not
+   * copied and must outlive the reader.
+   *
+   * @param data start of the serialized data
+   * @param size number of bytes available
+   * @param format options the data was written with
+   */
+  BinaryStreamReader(const char* data, size_t size,
+		     BinaryFormat format = binary_native):
+    StreamReader(), format_flags(format),
+    in_begin(data), in_pos(data), in_end(data + size) {
   }
 
   ~BinaryStreamReader() {
@@ -57,15 +142,369 @@ public:
   /**
    * Reads an STL string.
    * Treated specially here because this type is used to store identifiers for some classes.
+   * Strings with other allocators (eg. std::pmr::string) are read the same way.
    */
-  void load(std::string & string_data)
+  template <typename Traits, typename Alloc>
+  void load(std::basic_string<char, Traits, Alloc> & string_data)
   {
     read_and_check_types(string_data);
     read_data(string_data);
   }
 
+  /**
+   * Reads a length-prefixed run of arithmetic elements (a string, or
+   * a vector or array of T) as a view into the memory being read,
+   * without copying it.
+   *
+   * @param view_data view to point at the elements
+   * @throw ViewUnavailableException if not reading from memory, or if
+   * the elements are not stored in their in-memory representation
+   * (varint-encoded, or portable but not in the host's layout)
+   */
+  template <typename T>
+  void load(array_view<T> & view_data)
+  {
+    if (stream || (is_varint_encoded<T>::value && (format_flags & binary_varint))
+	|| (!has_portable_layout<T>::value && (format_flags & binary_portable)))
+      throw ViewUnavailableException();
+
+    size_t count = read_length_data();
+    const char* bytes = take_bytes(count, sizeof(T));
+    view_data = array_view<T>(bytes, count);
+  }
+
+#if __cplusplus >= 201703L
+  /**
+   * Reads a string as a view into the memory being read, without
+   * allocating or copying.
+   *
+   * @param view_data view to point at the characters of the string
+   * @throw ViewUnavailableException if not reading from memory
+   */
+  void load(std::string_view & view_data)
+  {
+    if (stream)
+      throw ViewUnavailableException();
+
+    size_t len = read_length_data();
+    const char* characters = take_bytes(len, 1);
+    view_data = std::string_view(characters, len);
+  }
+#endif
+
+  /**
+   * Read `count' contiguous elements of an arithmetic type with a
+   * single read, the counterpart of BinaryStreamWriter::save_elements.
+   *
+   * @param data pointer to the first element to read into
+   * @param count number of elements
+   */
+  template <typename T>
+  typename std::enable_if<is_bulk_serializable<T>::value>::type
+  load_elements(T* data, size_t count)
+  {
+    if (is_varint_encoded<T>::value && (format_flags & binary_varint))
+      {
+	for (size_t i = 0; i < count; ++i)
+	  read_data(data[i]);
+	return;
+      }
+    if (!has_portable_layout<T>::value && (format_flags & binary_portable))
+      {
+	read_portable_elements(data, count);
+	return;
+      }
+    read_bytes(reinterpret_cast<char*>(data), count * sizeof(T));
+  }
+
+  /**
+   * Reads the type of a polymorphic object, the counterpart of
+   * BinaryStreamWriter::write_type.
+   *
+   * @return Matching TiedInfoBase object for the type read, or
+   * nullptr with error codes
+   * @throw InvalidDataException if an undefined type id is read
+   * @throw TypeNotRegisteredException if the key read is not registered
+   */
+  TiedInfoBase<BinaryStreamReader>* load_type_info()
+  {
+    if (!(format_flags & binary_type_ids))
+      return load_type_key();
+
+    uint64_t id = read_varint();
+    if (id == 0)
+      {
+	type_ids.push_back(load_type_key());
+	return type_ids.back();
+      }
+    if (id > type_ids.size())
+      {
+	report_error(read_invalid_data, InvalidDataException());
+	return nullptr;
+      }
+    return type_ids[id - 1];
+  }
+
+  /**
+   * Read an object of fixed size (see fixed_size.hpp) in one step,
+   * the counterpart of BinaryStreamWriter::save_fixed. From memory
+   * this is a single bounds check; from a stream, a single read.
+   *
+   * @throw SizeMismatchException if `deserialize' does not read exactly
+   * fixed_binary_size<T> bytes
+   */
+  template <typename T>
+  void load_fixed(T & T_data)
+  {
+    if (format_flags & (binary_varint | binary_portable))
+      {
+	load(T_data);
+	deserialize(*this, T_data);
+	return;
+      }
+
+    const size_t size = fixed_binary_size<T>::value;
+    // past the end of the data, read_bytes below reports it
+    if (!stream && size <= bytes_remaining())
+      {
+	FixedBinaryReader fixed(in_pos, size);
+	in_pos += size;
+	load_fixed(fixed, T_data);
+	return;
+      }
+    char block[size];
+    read_bytes(block, size);
+    FixedBinaryReader fixed(block, size);
+    load_fixed(fixed, T_data);
+  }
+
+  /**
+   * Read the given members of `object' in order, the counterpart of
+   * BinaryStreamWriter::save_members: runs of adjacent arithmetic
+   * members are read with a single read.
+   *
+   * @param object object whose members are read
+   * @param members pointers to the members to read
+   */
+  template <typename C, typename... Members>
+  void load_members(C & object, Members... members)
+  {
+    if (format_flags & (binary_varint | binary_portable))
+      {
+	int in_order[] = {0, ((void)(*this>>(object.*members)), 0)...};
+	(void)in_order;
+	return;
+      }
+
+    char* run_begin = nullptr;
+    char* run_end = nullptr;
+    int in_order[] = {0, ((void)load_member(object.*members, run_begin, run_end), 0)...};
+    (void)in_order;
+    read_run(run_begin, run_end);
+  }
+
+  /**
+   * The next `size' bytes as one block, eg. data to be decoded
+   * separately by another reader (see chunks.hpp): in place when
+   * reading from memory, otherwise read into `storage', which grows as
+   * the bytes are actually read, since `size' may be corrupt.
+   *
+   * @param size number of bytes; with error codes, set to 0 if they
+   * are not all there
+   * @param storage where to read them when reading from a stream
+   *
+   * @return the first byte of the block
+   * @throw EndOfFileException if fewer than `size' bytes are left
+   */
+  const char* load_block(size_t & size, std::vector<char> & storage)
+  {
+    if (!stream)
+      return take_bytes(size, 1);
+    read_characters(storage, size);
+    if (storage.size() != size)
+      size = 0;
+    return storage.data();
+  }
+
+  /**
+   * @return the options of the format read
+   */
+  BinaryFormat format() const
+  {
+    return format_flags;
+  }
+
+  /**
+   * See ::presize_limit: from memory, no more elements than the bytes
+   * left could hold.
+   */
+  size_t presize_limit(size_t count, size_t element_size) const
+  {
+    size_t limit = stream ? max_presize_elements : bytes_remaining() / element_size;
+    return std::min(count, std::max<size_t>(limit, 1));
+  }
+
+  /**
+   * Number of bytes not yet read, when reading from memory.
+   */
+  size_t bytes_remaining() const
+  {
+    return in_end - in_pos;
+  }
+
+  /**
+   * Bytes read so far: from memory, or the stream position if the
+   * stream can tell.
+   */
+  size_t position() const
+  {
+    return stream ? StreamReader::position() : in_pos - in_begin;
+  }
+
+  /**
+   * See StreamReader::report_error. From memory, the rest of the data
+   * is skipped, so every later read fails its bounds check.
+   */
+  template <typename E>
+  void report_error(ReadError code, const E & exception)
+  {
+    StreamReader::report_error(code, exception);
+    in_pos = in_end;
+  }
+
 private:
 
+  template <typename T>
+  typename std::enable_if<is_bulk_serializable<T>::value>::type
+  load_member(T & member, char* & run_begin, char* & run_end)
+  {
+    char* bytes = reinterpret_cast<char*>(&member);
+    if (bytes != run_end)
+      {
+	read_run(run_begin, run_end);
+	run_begin = bytes;
+      }
+    run_end = bytes + sizeof(T);
+  }
+
+  template <typename T>
+  typename std::enable_if<!is_bulk_serializable<T>::value>::type
+  load_member(T & member, char* & run_begin, char* & run_end)
+  {
+    read_run(run_begin, run_end);
+    run_begin = run_end = nullptr;
+    *this>>member;
+  }
+
+  template <typename T>
+  void load_fixed(FixedBinaryReader & fixed, T & T_data)
+  {
+    fixed.use_error_codes(uses_error_codes());
+    deserialize(fixed, T_data);
+    fixed.check_complete();
+    if (fixed.failed())
+      report_error(fixed.error(), SizeMismatchException());
+  }
+
+  TiedInfoBase<BinaryStreamReader>* load_type_key()
+  {
+    std::string type_key;
+    *this>>type_key;
+    auto info = InfoList<BinaryStreamReader>::find_type_by_key(type_key);
+    if (!info && !failed())
+      report_error(read_type_not_registered, TypeNotRegisteredException(type_key));
+    return info;
+  }
+
+  void read_run(char* run_begin, char* run_end)
+  {
+    if (run_begin != run_end)
+      read_bytes(run_begin, run_end - run_begin);
+  }
+
+  /**
+   * All input goes through here. From memory, this is a bounds check
+   * and a memcpy; from a stream, a read followed by the usual check
+   * of the stream state. With error codes, bytes which could not be
+   * read are zero.
+   *
+   * @throw EndOfFileException if fewer than `size' bytes are left
+   */
+  void read_bytes(char* data, size_t size)
+  {
+    if (!stream)
+      {
+	if (size > static_cast<size_t>(in_end - in_pos))
+	  {
+	    report_error(read_end_of_file, EndOfFileException());
+	    std::memset(data, 0, size);
+	    return;
+	  }
+	std::memcpy(data, in_pos, size);
+	in_pos += size;
+	return;
+      }
+
+    stream->read(data, size);
+    if (!check_stream())
+      std::memset(data + stream->gcount(), 0, size - stream->gcount());
+  }
+
+  /**
+   * The length of a string or array, stored as a uint64_t (see
+   * write_length).
+   */
+  size_t read_length_data()
+  {
+    uint64_t length = 0;
+    read_data(length);
+    return checked_length(length);
+  }
+
+  /**
+   * Unsigned LEB128, see BinaryStreamWriter::write_varint.
+   *
+   * @throw InvalidDataException if longer than a 64-bit value, or if
+   * the 10th byte holds more than its last bit
+   */
+  uint64_t read_varint()
+  {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+      {
+	unsigned char byte = 0;
+	read_bytes(reinterpret_cast<char*>(&byte), 1);
+	// only bit 63 is left for the 10th byte
+	if (shift == 63 && byte > 1)
+	  break;
+	value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+	if (!(byte & 0x80))
+	  return value;
+      }
+    report_error(read_invalid_data, InvalidDataException());
+    return 0;
+  }
+
+  /**
+   * Claims the next `count' elements of `element_size' bytes each
+   * from the memory being read, and returns where they start. With
+   * error codes, `count' is set to 0 if not enough bytes are left.
+   *
+   * @throw EndOfFileException if not enough bytes are left
+   */
+  const char* take_bytes(size_t & count, size_t element_size)
+  {
+    if (count > bytes_remaining() / element_size)
+      {
+	report_error(read_end_of_file, EndOfFileException());
+	count = 0;
+      }
+
+    const char* start = in_pos;
+    in_pos += count * element_size;
+    return start;
+  }
+
   /**
    * Not checking types now; just a stub
    */
@@ -87,8 +526,86 @@ private:
   typename std::enable_if<std::is_fundamental<T>::value,void>::type
   read_data(T & T_data)
   {
-    stream->read(reinterpret_cast<char*>(&T_data), sizeof(T_data));
-    checkandthrowBasicException(stream);    
+    read_value(T_data, is_varint_encoded<T>());
+  }
+
+  template <class T>
+  void read_value(T & T_data, std::false_type)
+  {
+    if (format_flags & binary_portable)
+      read_portable_elements(&T_data, 1);
+    else
+      read_bytes(reinterpret_cast<char*>(&T_data), sizeof(T_data));
+  }
+
+  /**
+   * Read elements in their portable representation and convert them
+   * to T, a chunk at a time.
+   *
+   * @throw InvalidDataException if a value does not fit in T (eg. a
+   * 64-bit long read on a host where long has 32 bits)
+   */
+  template <class T>
+  void read_portable_elements(T* data, size_t count)
+  {
+    typedef typename portable_type<T>::type Portable;
+    const size_t chunk_size = 256;
+    Portable chunk[chunk_size];
+
+    while (count > 0)
+      {
+	size_t n = std::min(count, chunk_size);
+	read_bytes(reinterpret_cast<char*>(chunk), n * sizeof(Portable));
+	host_to_little_endian(chunk, n);
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    data[i] = static_cast<T>(chunk[i]);
+	    if (std::is_integral<T>::value && static_cast<Portable>(data[i]) != chunk[i])
+	      {
+		report_error(read_invalid_data, InvalidDataException());
+		data[i] = 0;
+	      }
+	  }
+	data += n;
+	count -= n;
+      }
+  }
+
+  /**
+   * Integers are read as varints with binary_varint, zigzag decoded
+   * if signed.
+   *
+   * @throw InvalidDataException if the value read does not fit in T
+   */
+  template <class T>
+  void read_value(T & T_data, std::true_type)
+  {
+    if (!(format_flags & binary_varint))
+      {
+	read_value(T_data, std::false_type());
+	return;
+      }
+
+    uint64_t encoded = read_varint();
+    if (std::is_signed<T>::value)
+      {
+	int64_t value = zigzag_decode(encoded);
+	T_data = static_cast<T>(value);
+	if (static_cast<int64_t>(T_data) != value)
+	  {
+	    report_error(read_invalid_data, InvalidDataException());
+	    T_data = 0;
+	  }
+      }
+    else
+      {
+	T_data = static_cast<T>(encoded);
+	if (static_cast<uint64_t>(T_data) != encoded)
+	  {
+	    report_error(read_invalid_data, InvalidDataException());
+	    T_data = 0;
+	  }
+      }
   }
 
   /**
@@ -103,34 +620,30 @@ private:
   read_data(T & T_array_data)
   {
     size_t array_size = std::extent<T>::value;
-    size_t stored_array_size;
+    size_t stored_array_size = read_length(*this);
 
-    *this>>stored_array_size;
     if (stored_array_size != array_size)
-      {
-	// throw exception
-	throw SizeMismatchException(stored_array_size, array_size);
-      }
+      report_error(read_size_mismatch, SizeMismatchException(stored_array_size, array_size));
 
-    for (size_t i = 0; i < array_size; ++i)
-	*this>>T_array_data[i];
+    deserialize_elements(*this, T_array_data, array_size);
   }
   /**
    * Read data from stream into a std::string
    * @param a string
    */
-  void read_data(std::string & string_data)
+  template <typename Traits, typename Alloc>
+  void read_data(std::basic_string<char, Traits, Alloc> & string_data)
   {
-    size_t len;
-    stream->read(reinterpret_cast<char*>(&len),sizeof(len));
-
-    char* s = new char[len + 1];
-    stream->read(s, len);
-    s[len] = '\0';
-    string_data = std::string(s, len);
-    delete[] s;
+    size_t len = read_length_data();
 
-    checkandthrowBasicException(stream);    
+    // straight into the string's own storage, no temporary buffer
+    if (!stream)
+      {
+	const char* characters = take_bytes(len, 1);
+	string_data.assign(characters, len);
+	return;
+      }
+    read_characters(string_data, len);
   }
 
     /** 
@@ -142,18 +655,76 @@ private:
    */
   void read_data(char* & cstring_data)
   {
-    size_t len;
-    stream->read(reinterpret_cast<char*>(&len),sizeof(len));
+    size_t len = read_length_data();
 
-    char* s = new char[len + 1];
-    stream->read(s,len);
-    s[len] = '\0';
-    cstring_data = s;
+    // from memory, check the length before allocating for it
+    if (!stream)
+      {
+	const char* source = take_bytes(len, 1);
+	cstring_data = new char[len + 1];
+	std::memcpy(cstring_data, source, len);
+	cstring_data[len] = '\0';
+	return;
+      }
 
-    checkandthrowBasicException(stream);
+    std::string characters;
+    read_characters(characters, len);
+    cstring_data = new char[characters.size() + 1];
+    std::memcpy(cstring_data, characters.c_str(), characters.size() + 1);
   }
 
+  BinaryFormat format_flags;	/**< options the data was written with */
+  std::vector<TiedInfoBase<BinaryStreamReader>*> type_ids; /**< types by id, with binary_type_ids */
+  const char* in_begin;		/**< start of the data, when reading from memory */
+  const char* in_pos;		/**< next byte to read, when reading from memory */
+  const char* in_end;		/**< end of the data, when reading from memory */
 };
 
+/**
+ * Types of polymorphic objects may be stored as ids rather than keys.
+ */
+inline TiedInfoBase<BinaryStreamReader>* read_type_info(BinaryStreamReader & reader)
+{
+  return reader.load_type_info();
+}
+
+inline size_t presize_limit(BinaryStreamReader & reader, size_t count, size_t element_size)
+{
+  return reader.presize_limit(count, element_size);
+}
+
+/**
+ * Arrays and vectors of arithmetic types are read as one block rather
+ * than through >> for every element.
+ */
+template <typename T>
+typename std::enable_if<is_bulk_serializable<T>::value>::type
+deserialize_elements(BinaryStreamReader & reader, T* data, size_t count)
+{
+  reader.load_elements(data, count);
+}
+
+/**
+ * Members declared with SERIALIZE_MEMBERS are read in runs of
+ * adjacent members rather than one by one.
+ */
+template <typename C, typename... Members>
+void deserialize_members(BinaryStreamReader & reader, C & object, Members... members)
+{
+  reader.load_members(object, members...);
+}
+
+/**
+ * Objects of fixed size are read in one step rather than member by
+ * member.
+ */
+template <typename T>
+typename std::enable_if<is_fixed_size_object<T>::value, BinaryStreamReader&>::type
+operator>>(BinaryStreamReader & reader, T & T_data)
+{
+  SERIALIZE_PROFILE_TYPE(reader, T);
+  reader.load_fixed(T_data);
+  return reader;
+}
 
 #endif
@@ -4,28 +4,129 @@
  * @date   Tue Dec  4 17:39:19 2012
  *
  * @brief  Classes/methods to serialize binary data in a compact format
- * Expected to be used for native data i.e. currently non-portable. Will be extended to portable also in next revision
+ * By default the data is native i.e. non-portable; with the binary_portable
+ * format option it can be read on hosts of any byte order and word size.
  */
 
 #ifndef BINARY_STREAMWRITER_HPP
 #define BINARY_STREAMWRITER_HPP
 #include "streamwriter.hpp"
 #include "stl_serialize.hpp"
+#include "byte_order.hpp"
+#include "fixed_size.hpp"
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 
+/**
+ * Writes the binary format to an output stream, either directly or
+ * through an output buffer.
+ *
+ * Unbuffered (the default), every field is a separate ostream::write.
+ * Buffered, fields are copied into a byte buffer which is written to
+ * the stream in large chunks when it fills up, on flush(), and on
+ * destruction. The buffer may be owned by the writer or supplied by
+ * the user. A writer may also append to a std::vector<char> without
+ * any stream at all.
+ *
+ * Every constructor takes an optional BinaryFormat; the reader must
+ * be given the same one.
+ */
 class BinaryStreamWriter: public StreamWriter
 {
 public:
   /**
    * Constructed from an output stream which could be any sequential access
    */
-  BinaryStreamWriter(std::ostream&m_stream): StreamWriter(m_stream)  {
+  BinaryStreamWriter(std::ostream&m_stream, BinaryFormat format = binary_native):
+    StreamWriter(m_stream), format_flags(format),
+    buf_begin(nullptr), buf_pos(nullptr), buf_end(nullptr),
+    memory_output(nullptr)
+  {
+  }
+
+  /**
+   * Buffered writer. Output is collected in an internal buffer of
+   * `buffer_size' bytes and written to the stream whenever the buffer
+   * is full. Blocks larger than the buffer bypass it.
+   *
+   * @param m_stream open output stream
+   * @param buffer_size size of the buffer in bytes
+   */
+  BinaryStreamWriter(std::ostream& m_stream, size_t buffer_size,
+		     BinaryFormat format = binary_native):
+    StreamWriter(m_stream), format_flags(format),
+    own_buffer(new char[buffer_size]), memory_output(nullptr)
+  {
+    set_buffer(own_buffer.get(), buffer_size);
+  }
 
+  /**
+   * Buffered writer using a buffer supplied by the caller, which must
+   * outlive the writer.
+   *
+   * @param m_stream open output stream
+   * @param buffer buffer of at least `buffer_size' bytes
+   * @param buffer_size size of the buffer in bytes
+   */
+  BinaryStreamWriter(std::ostream& m_stream, char* buffer, size_t buffer_size,
+		     BinaryFormat format = binary_native):
+    StreamWriter(m_stream), format_flags(format), memory_output(nullptr)
+  {
+    set_buffer(buffer, buffer_size);
   }
+
+  /**
+   * Writer appending to a growable byte vector instead of a stream.
+   * The vector is only guaranteed to hold exactly the written bytes
+   * after flush() or destruction of the writer; in between it may
+   * have spare capacity at the end.
+   *
+   * @param output vector to append to, must outlive the writer
+   */
+  BinaryStreamWriter(std::vector<char>& output,
+		     BinaryFormat format = binary_native):
+    StreamWriter(), format_flags(format), memory_output(&output)
+  {
+    size_t used = output.size();
+    set_buffer(output.data(), used);
+    buf_pos = buf_end;
+  }
+
+  BinaryStreamWriter(const BinaryStreamWriter&) = delete;
+  BinaryStreamWriter& operator=(const BinaryStreamWriter&) = delete;
+
   ~BinaryStreamWriter();
 
+  /**
+   * Bytes written so far: the stream position (if the stream can
+   * tell) plus what is still buffered, or the bytes in the output
+   * vector.
+   */
+  size_t position() const
+  {
+    size_t buffered = buf_pos - buf_begin;
+    return memory_output ? buffered : StreamWriter::position() + buffered;
+  }
+
+  /**
+   * Write out everything buffered so far and flush the stream. For a
+   * writer appending to a vector, trims the vector to the bytes
+   * written.
+   */
+  void flush()
+  {
+    flush_buffer();
+    if (stream)
+      stream->flush();
+  }
+
   template <typename T>
   typename std::enable_if<std::is_fundamental<T>::value>::type
   save(const T & T_data)
@@ -33,7 +134,8 @@ public:
     write_data(T_data);
   }
 
-  void save(const std::string & string_data)
+  template <typename Traits, typename Alloc>
+  void save(const std::basic_string<char, Traits, Alloc> & string_data)
   {
     write_data(string_data);
   }
@@ -60,16 +162,317 @@ public:
   {
     // number of elements
     size_t length = std::extent<T>::value;
-    *this<<length;
-    for (size_t i = 0; i < length; ++i)
-        *this<<T_data[i];
+    write_length(*this, length);
+    serialize_elements(*this, T_data, length);
+  }
+
+  /**
+   * Write `count' contiguous elements of an arithmetic type with a
+   * single write. The output is identical to writing them one by one.
+   * With binary_varint, integers are encoded one by one.
+   *
+   * @param data pointer to the first element
+   * @param count number of elements
+   */
+  template <typename T>
+  typename std::enable_if<is_bulk_serializable<T>::value>::type
+  save_elements(const T* data, size_t count)
+  {
+    if (is_varint_encoded<T>::value && (format_flags & binary_varint))
+      {
+	for (size_t i = 0; i < count; ++i)
+	  write_data(data[i]);
+	return;
+      }
+    if (!has_portable_layout<T>::value && (format_flags & binary_portable))
+      {
+	write_portable_elements(data, count);
+	return;
+      }
+    write_bytes(reinterpret_cast<const char*>(data), count * sizeof(T));
+  }
+
+  /**
+   * Write `size' bytes as they are, eg. data encoded separately by
+   * another writer with the same format (see chunks.hpp).
+   *
+   * @param data first byte
+   * @param size number of bytes
+   */
+  void save_block(const char* data, size_t size)
+  {
+    write_bytes(data, size);
+  }
+
+  /**
+   * @return the options of the format written
+   */
+  BinaryFormat format() const
+  {
+    return format_flags;
+  }
+
+  /**
+   * Write an object of fixed size (see fixed_size.hpp) in one step:
+   * reserve its bytes in the buffer with a single check and let
+   * `serialize' fill them in. Without room in a buffer the object is
+   * encoded on the stack and written with a single write.
+   *
+   * @throw SizeMismatchException if `serialize' does not write exactly
+   * fixed_binary_size<T> bytes
+   */
+  template <typename T>
+  void save_fixed(const T & T_data)
+  {
+    if (format_flags & (binary_varint | binary_portable))
+      {
+	save(T_data);
+	serialize(*this, T_data);
+	return;
+      }
+
+    const size_t size = fixed_binary_size<T>::value;
+    if (char* out = reserve_bytes(size))
+      {
+	FixedBinaryWriter fixed(out, size);
+	serialize(fixed, T_data);
+	fixed.check_complete();
+	buf_pos += size;
+	return;
+      }
+    char block[size];
+    FixedBinaryWriter fixed(block, size);
+    serialize(fixed, T_data);
+    fixed.check_complete();
+    write_bytes(block, size);
+  }
+
+  /**
+   * Write the given members of `object' in order. Runs of arithmetic
+   * members which are adjacent in memory, with no padding between
+   * them, are written with a single write; the bytes are the same as
+   * writing them one by one. With binary_varint or binary_portable
+   * every member is written separately.
+   *
+   * @param object object whose members are written
+   * @param members pointers to the members to write
+   */
+  template <typename C, typename... Members>
+  void save_members(const C & object, Members... members)
+  {
+    if (format_flags & (binary_varint | binary_portable))
+      {
+	int in_order[] = {0, ((void)(*this<<(object.*members)), 0)...};
+	(void)in_order;
+	return;
+      }
+
+    const char* run_begin = nullptr;
+    const char* run_end = nullptr;
+    int in_order[] = {0, ((void)save_member(object.*members, run_begin, run_end), 0)...};
+    (void)in_order;
+    write_run(run_begin, run_end);
   }
 
 private:
+  /**
+   * Extend the current run of adjacent members with `member' if it
+   * starts where the run ends; otherwise write the run and start a new
+   * one.
+   */
+  template <typename T>
+  typename std::enable_if<is_bulk_serializable<T>::value>::type
+  save_member(const T & member, const char* & run_begin, const char* & run_end)
+  {
+    const char* bytes = reinterpret_cast<const char*>(&member);
+    if (bytes != run_end)
+      {
+	write_run(run_begin, run_end);
+	run_begin = bytes;
+      }
+    run_end = bytes + sizeof(T);
+  }
+
+  template <typename T>
+  typename std::enable_if<!is_bulk_serializable<T>::value>::type
+  save_member(const T & member, const char* & run_begin, const char* & run_end)
+  {
+    write_run(run_begin, run_end);
+    run_begin = run_end = nullptr;
+    *this<<member;
+  }
+
+  void write_run(const char* run_begin, const char* run_end)
+  {
+    if (run_begin != run_end)
+      write_bytes(run_begin, run_end - run_begin);
+  }
+
+  /**
+   * All output goes through here. The common case of a small write
+   * into a buffer with room left is a single compare and memcpy.
+   */
+  void write_bytes(const char* data, size_t size)
+  {
+    if (size < static_cast<size_t>(buf_end - buf_pos))
+      {
+	std::memcpy(buf_pos, data, size);
+	buf_pos += size;
+	return;
+      }
+    write_bytes_slow(data, size);
+  }
+
+  /**
+   * Writes which do not fit in the buffer: unbuffered writes, buffer
+   * flushes, and growing the output vector.
+   */
+  void write_bytes_slow(const char* data, size_t size)
+  {
+    if (memory_output)
+      {
+	grow_memory_output(size);
+	std::memcpy(buf_pos, data, size);
+	buf_pos += size;
+	return;
+      }
+
+    flush_buffer();
+    if (size >= static_cast<size_t>(buf_end - buf_begin))
+      {
+	stream->write(data, size);
+	return;
+      }
+    std::memcpy(buf_pos, data, size);
+    buf_pos += size;
+  }
+
+  /**
+   * Make room for at least `size' more bytes in the output vector.
+   */
+  void grow_memory_output(size_t size)
+  {
+    size_t used = buf_pos - memory_output->data();
+    size_t new_size = std::max(used + size, 2 * memory_output->size());
+    memory_output->resize(std::max(new_size, static_cast<size_t>(256)));
+    set_buffer(memory_output->data(), memory_output->size());
+    buf_pos += used;
+  }
+
+  /**
+   * Room for the next `size' bytes in the buffer, flushing or growing
+   * it if needed.
+   *
+   * @return where to put them, or nullptr if the writer is unbuffered
+   * or its buffer is smaller than `size'
+   */
+  char* reserve_bytes(size_t size)
+  {
+    if (size <= static_cast<size_t>(buf_end - buf_pos))
+      return buf_pos;
+    if (memory_output)
+      grow_memory_output(size);
+    else if (size <= static_cast<size_t>(buf_end - buf_begin))
+      flush_buffer();
+    else
+      return nullptr;
+    return buf_pos;
+  }
+
+  /**
+   * Hand the buffered bytes to the stream (or trim the output vector
+   * to them) and start over with an empty buffer.
+   */
+  void flush_buffer()
+  {
+    if (memory_output)
+      {
+	memory_output->resize(buf_pos - buf_begin);
+	set_buffer(memory_output->data(), memory_output->size());
+	buf_pos = buf_end;
+	return;
+      }
+
+    if (buf_pos != buf_begin)
+      stream->write(buf_begin, buf_pos - buf_begin);
+    buf_pos = buf_begin;
+  }
+
+  void set_buffer(char* buffer, size_t buffer_size)
+  {
+    buf_begin = buffer;
+    buf_pos = buffer;
+    buf_end = buffer + buffer_size;
+  }
+
+  /**
+   * Unsigned LEB128: seven bits per byte, low bits first, high bit
+   * set on every byte but the last.
+   */
+  void write_varint(uint64_t value)
+  {
+    char bytes[10];
+    size_t len = 0;
+    while (value >= 0x80)
+      {
+	bytes[len++] = static_cast<char>(value | 0x80);
+	value >>= 7;
+      }
+    bytes[len++] = static_cast<char>(value);
+    write_bytes(bytes, len);
+  }
+
   template <class T>
   void write_data(const T & T_data)
   {
-    stream->write(reinterpret_cast<const char*>(&T_data), sizeof(T_data));
+    write_value(T_data, is_varint_encoded<T>());
+  }
+
+  template <class T>
+  void write_value(const T & T_data, std::false_type)
+  {
+    if (format_flags & binary_portable)
+      write_portable_elements(&T_data, 1);
+    else
+      write_bytes(reinterpret_cast<const char*>(&T_data), sizeof(T_data));
+  }
+
+  /**
+   * Convert elements to their portable representation and write them,
+   * a chunk at a time.
+   */
+  template <class T>
+  void write_portable_elements(const T* data, size_t count)
+  {
+    typedef typename portable_type<T>::type Portable;
+    const size_t chunk_size = 256;
+    Portable chunk[chunk_size];
+
+    while (count > 0)
+      {
+	size_t n = std::min(count, chunk_size);
+	for (size_t i = 0; i < n; ++i)
+	  chunk[i] = static_cast<Portable>(data[i]);
+	host_to_little_endian(chunk, n);
+	write_bytes(reinterpret_cast<const char*>(chunk), n * sizeof(Portable));
+	data += n;
+	count -= n;
+      }
+  }
+
+  /**
+   * Integers are written as varints with binary_varint, zigzag
+   * encoded if signed.
+   */
+  template <class T>
+  void write_value(const T & T_data, std::true_type)
+  {
+    if (!(format_flags & binary_varint))
+      write_value(T_data, std::false_type());
+    else if (std::is_signed<T>::value)
+      write_varint(zigzag_encode(static_cast<int64_t>(T_data)));
+    else
+      write_varint(static_cast<uint64_t>(T_data));
   }
 
   /** 
@@ -84,33 +487,102 @@ private:
     while (cstring_data[slen] != '\0')
       slen++;
     
-    stream->write(reinterpret_cast<const char*>(&slen), sizeof(slen));
-    stream->write(cstring_data, slen);
+    write_data(static_cast<uint64_t>(slen));
+    write_bytes(cstring_data, slen);
   }
 
-  void write_data(const std::string& string_data)
+  template <typename Traits, typename Alloc>
+  void write_data(const std::basic_string<char, Traits, Alloc>& string_data)
   {
-    size_t slen = string_data.size();
-    stream->write(reinterpret_cast<const char*>(&slen), sizeof(slen));
-    stream->write(string_data.c_str(), string_data.size());
+    write_data(static_cast<uint64_t>(string_data.size()));
+    write_bytes(string_data.data(), string_data.size());
   }
 
   /**
    * Serialize pointers to polymorphic objects
    * Must write the type key also as there is no other way to know what object it represents at runtime
+   *
+   * With binary_type_ids, the key is only written the first time a
+   * type is seen, as a 0 followed by the key. The type is then given
+   * the next id (starting at 1), and later objects of that type are
+   * written as just the id, as a varint.
+   *
    * @param T* pointer to polymorphic base class
    */
   template <class T>
   typename std::enable_if<std::is_polymorphic<T>::value>::type
   write_type(T* & T_data)
   {
-    std::string type_key(InfoList<BinaryStreamWriter>::get_matching_type(T_data)->key());
-    *this<<type_key;
+    auto type_info = InfoList<BinaryStreamWriter>::get_matching_type(T_data);
+    if (!(format_flags & binary_type_ids))
+      {
+	*this<<type_info->key();
+	return;
+      }
+
+    auto id_iter = type_ids.find(type_info);
+    if (id_iter != type_ids.end())
+      {
+	write_varint(id_iter->second);
+	return;
+      }
+    size_t id = type_ids.size() + 1;
+    type_ids[type_info] = id;
+    write_varint(0);
+    *this<<type_info->key();
   }
+
+  BinaryFormat format_flags;	/**< options of the format written */
+  std::unordered_map<TiedInfoBase<BinaryStreamWriter>*, size_t> type_ids; /**< ids given to types so far, with binary_type_ids */
+
+  char* buf_begin;		/**< start of the output buffer */
+  char* buf_pos;		/**< next byte to write in the buffer */
+  char* buf_end;		/**< end of the output buffer */
+  std::unique_ptr<char[]> own_buffer; /**< buffer allocated by the writer, if any */
+  std::vector<char>* memory_output;   /**< vector written to instead of a stream, if any */
 };
 
+/**
+ * Writes out whatever is still buffered. Does not flush or close the
+ * stream itself.
+ */
 BinaryStreamWriter::~BinaryStreamWriter()
 {
+  flush_buffer();
+}
+
+/**
+ * Arrays and vectors of arithmetic types are written as one block
+ * rather than through << for every element.
+ */
+template <typename T>
+typename std::enable_if<is_bulk_serializable<T>::value>::type
+serialize_elements(BinaryStreamWriter & writer, const T* data, size_t count)
+{
+  writer.save_elements(data, count);
+}
+
+/**
+ * Members declared with SERIALIZE_MEMBERS are written in runs of
+ * adjacent members rather than one by one.
+ */
+template <typename C, typename... Members>
+void serialize_members(BinaryStreamWriter & writer, const C & object, Members... members)
+{
+  writer.save_members(object, members...);
+}
+
+/**
+ * Objects of fixed size are written in one step rather than member by
+ * member.
+ */
+template <typename T>
+typename std::enable_if<is_fixed_size_object<T>::value, BinaryStreamWriter&>::type
+operator<<(BinaryStreamWriter & writer, const T & T_data)
+{
+  SERIALIZE_PROFILE_TYPE(writer, T);
+  writer.save_fixed(T_data);
+  return writer;
 }
 
 #endif
@@ -0,0 +1,147 @@
+/**
+ * @file   byte_order.hpp
+ * 
+ * @brief Wire representation of fundamental types in the portable
+ * binary format (binary_portable): fixed width, little-endian, IEEE-754.
+ * 
+ * Every fundamental type T is written as portable_type<T>::type, with
+ * its bytes in little-endian order. `long' and `unsigned long' are
+ * always written as 64 bits and wchar_t as 32 bits, since their size
+ * differs between platforms; long double is written as a double.
+ *
+ * Sizes of containers and strings are not written as size_t, which is
+ * `unsigned int' on 32-bit platforms, but always as uint64_t (see
+ * write_length).
+ */
+
+#ifndef BYTE_ORDER_HPP
+#define BYTE_ORDER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) \
+  && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr bool host_is_little_endian = false;
+#else
+constexpr bool host_is_little_endian = true;
+#endif
+
+static_assert(std::numeric_limits<float>::is_iec559
+	      && std::numeric_limits<double>::is_iec559,
+	      "the portable binary format requires IEEE-754 float and double");
+
+/**
+ * Type (of fixed size) in which a fundamental type T is stored by the
+ * portable format. Types whose size is the same everywhere are stored
+ * as themselves.
+ */
+template <typename T, typename Enable = void>
+struct portable_type
+{
+  typedef T type;
+};
+
+template <typename T>
+struct portable_type<T, typename std::enable_if<
+			  std::is_same<T, long>::value
+			  || std::is_same<T, unsigned long>::value>::type>
+{
+  typedef typename std::conditional<std::is_signed<T>::value,
+				    int64_t, uint64_t>::type type;
+};
+
+template <>
+struct portable_type<wchar_t>
+{
+  typedef std::conditional<std::is_signed<wchar_t>::value,
+			   int32_t, uint32_t>::type type;
+};
+
+template <>
+struct portable_type<long double>
+{
+  typedef double type;
+};
+
+/**
+ * True if an array of T already is in its portable representation on
+ * this host, so it can be written and read as a block.
+ */
+template <typename T>
+struct has_portable_layout:
+  std::integral_constant<bool, host_is_little_endian
+			 && std::is_same<typename portable_type<T>::type, T>::value>
+{
+};
+
+/**
+ * Unsigned integer of a given size, used to swap bytes of any type of
+ * that size.
+ */
+template <size_t Size> struct unsigned_of_size;
+template <> struct unsigned_of_size<1> { typedef uint8_t type; };
+template <> struct unsigned_of_size<2> { typedef uint16_t type; };
+template <> struct unsigned_of_size<4> { typedef uint32_t type; };
+template <> struct unsigned_of_size<8> { typedef uint64_t type; };
+
+inline uint8_t byteswap(uint8_t value)
+{
+  return value;
+}
+
+inline uint16_t byteswap(uint16_t value)
+{
+  return static_cast<uint16_t>((value >> 8) | (value << 8));
+}
+
+inline uint32_t byteswap(uint32_t value)
+{
+  return ((value & 0x000000ffu) << 24) | ((value & 0x0000ff00u) << 8)
+    | ((value & 0x00ff0000u) >> 8) | ((value & 0xff000000u) >> 24);
+}
+
+inline uint64_t byteswap(uint64_t value)
+{
+  return (static_cast<uint64_t>(byteswap(static_cast<uint32_t>(value))) << 32)
+    | byteswap(static_cast<uint32_t>(value >> 32));
+}
+
+/**
+ * Reverse the bytes of each of `count' elements in place.
+ *
+ * The loop body is a load, a shift-and-mask byte swap and a store,
+ * which compilers recognize as a byte swap and vectorize into byte
+ * shuffles (pshufb, vperm, rev), so whole arrays are converted several
+ * elements per instruction.
+ */
+template <typename T>
+void byteswap_elements(T* data, size_t count)
+{
+  typedef typename unsigned_of_size<sizeof(T)>::type U;
+  unsigned char* bytes = reinterpret_cast<unsigned char*>(data);
+  for (size_t i = 0; i < count; ++i)
+    {
+      U value;
+      std::memcpy(&value, bytes + i * sizeof(U), sizeof(U));
+      value = byteswap(value);
+      std::memcpy(bytes + i * sizeof(U), &value, sizeof(U));
+    }
+}
+
+/**
+ * Convert `count' elements between host and little-endian byte order
+ * (the conversion is its own inverse). Does nothing on little-endian
+ * hosts.
+ */
+template <typename T>
+void host_to_little_endian(T* data, size_t count)
+{
+  if (!host_is_little_endian && sizeof(T) > 1)
+    byteswap_elements(data, count);
+}
+
+#endif // BYTE_ORDER_HPP
@@ -0,0 +1,373 @@
+/**
+ * @file   chunks.hpp
+ *
+ * @brief Parallel encoding and decoding of large vectors and maps in
+ * the binary format, split into chunks which are independent of each
+ * other.
+ *
+ * Wrapped with as_chunks, a container is written by several threads:
+ *
+ * writer<<as_chunks(states);
+ * reader>>as_chunks(states_read);
+ *
+ * The elements are split into chunks of `chunk_size' elements, each
+ * encoded by a worker thread into a buffer of its own, with a
+ * BinaryStreamWriter of the same format. The format is:
+ *
+ *  - the number of elements and the number of chunks (see write_length),
+ *  - a directory of the chunks: for each one, its number of elements
+ *    and of bytes (also with write_length),
+ *  - the chunks, one after another.
+ *
+ * As every chunk can be decoded on its own, the reader decodes them in
+ * parallel too: a vector straight into its new elements, a map into
+ * one vector of pairs per chunk, inserted in order afterwards. From a
+ * stream, the chunks are read into memory first.
+ *
+ * Being independent, chunks share no state: with object tracking an
+ * object pointed to from two chunks is written once in each, and with
+ * binary_type_ids type ids are numbered per chunk. Readers of chunks
+ * do not construct objects in the arena of the reader (see
+ * StreamReader::use_arena), and polymorphic types have to be
+ * registered beforehand (see InfoList). While writing, all the encoded
+ * chunks are held in memory.
+ *
+ * Every element has to be encoded in at least one byte, which is what
+ * the reader checks the directory against; elements of types without
+ * any data can not be written in chunks.
+ *
+ * This is not compatible with writing the container itself; both
+ * sides have to use as_chunks. As with vectors and maps, elements read
+ * are added to those already there; with error codes, the container is
+ * left as it was if a chunk can not be read.
+ */
+
+#ifndef CHUNKS_HPP
+#define CHUNKS_HPP
+#include "binary_streamwriter.hpp"
+#include "binary_streamreader.hpp"
+#include "exceptions.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <map>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * A vector or map to be written or read in chunks, in parallel. Made
+ * by as_chunks.
+ */
+template <typename Container>
+struct chunked
+{
+  Container & elements;		/**< the container, const when writing */
+  size_t chunk_size;		/**< elements per chunk, when writing */
+  unsigned threads;		/**< threads to use, 0 for one per core */
+};
+
+template <typename T, typename Alloc>
+chunked<const std::vector<T, Alloc> >
+as_chunks(const std::vector<T, Alloc> & elements, size_t chunk_size = 65536, unsigned threads = 0)
+{
+  return chunked<const std::vector<T, Alloc> > {elements, chunk_size, threads};
+}
+
+template <typename T, typename Alloc>
+chunked<std::vector<T, Alloc> >
+as_chunks(std::vector<T, Alloc> & elements, size_t chunk_size = 65536, unsigned threads = 0)
+{
+  return chunked<std::vector<T, Alloc> > {elements, chunk_size, threads};
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+chunked<const std::map<K, V, Compare, Alloc> >
+as_chunks(const std::map<K, V, Compare, Alloc> & elements, size_t chunk_size = 65536,
+	  unsigned threads = 0)
+{
+  return chunked<const std::map<K, V, Compare, Alloc> > {elements, chunk_size, threads};
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+chunked<std::map<K, V, Compare, Alloc> >
+as_chunks(std::map<K, V, Compare, Alloc> & elements, size_t chunk_size = 65536,
+	  unsigned threads = 0)
+{
+  return chunked<std::map<K, V, Compare, Alloc> > {elements, chunk_size, threads};
+}
+
+/**
+ * Call job(i) for every chunk i < count, on up to `threads' threads
+ * (0 for one per core), the calling one included. If a job throws, no
+ * more jobs are started, and the first exception is rethrown once
+ * every thread has finished.
+ */
+template <typename Job>
+void run_chunk_jobs(size_t count, unsigned threads, Job job)
+{
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t workers = std::min<size_t>(threads, count);
+
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    try
+      {
+	for (size_t i = next++; i < count; i = next++)
+	  job(i);
+      }
+    catch (...)
+      {
+	next = count;
+	throw;
+      }
+  };
+
+  std::vector<std::future<void> > running;
+  for (size_t w = 1; w < workers; ++w)
+    running.push_back(std::async(std::launch::async, work));
+  std::exception_ptr error;
+  try
+    {
+      work();
+    }
+  catch (...)
+    {
+      error = std::current_exception();
+    }
+  for (std::future<void> & r : running)
+    try
+      {
+	r.get();
+      }
+    catch (...)
+      {
+	if (!error)
+	  error = std::current_exception();
+      }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+/**
+ * Encode `count' elements in chunks of `chunk_size', in parallel, and
+ * write them with their directory. write_chunk(chunk_writer, i, first,
+ * n) writes the n elements of chunk i, starting with element `first'.
+ */
+template <typename WriteChunk>
+void write_chunks(BinaryStreamWriter & writer, size_t count, size_t chunk_size,
+		  unsigned threads, WriteChunk write_chunk)
+{
+  if (chunk_size == 0)
+    chunk_size = 1;
+  size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+  std::vector<std::vector<char> > encoded(chunk_count);
+  bool tracking = writer.written_objects().is_tracking();
+
+  run_chunk_jobs(chunk_count, threads, [&](size_t i) {
+      BinaryStreamWriter chunk_writer(encoded[i], writer.format());
+      chunk_writer.track_objects(tracking);
+      size_t first = i * chunk_size;
+      write_chunk(chunk_writer, i, first, std::min(chunk_size, count - first));
+      chunk_writer.flush();
+    });
+
+  write_length(writer, count);
+  write_length(writer, chunk_count);
+  for (size_t i = 0; i < chunk_count; ++i)
+    {
+      write_length(writer, std::min(chunk_size, count - i * chunk_size));
+      write_length(writer, encoded[i].size());
+    }
+  for (const std::vector<char> & chunk : encoded)
+    writer.save_block(chunk.data(), chunk.size());
+}
+
+/**
+ * Read the directory and the chunks written by write_chunks. Once the
+ * numbers of elements and of chunks are known, prepare(count,
+ * chunk_count) makes room for them. Then read_chunk(chunk_reader, i,
+ * first, n) is called in parallel for every chunk i, of n elements
+ * starting with element `first'.
+ *
+ * Nothing is allocated for the elements before all the chunks are
+ * there: from memory, they must fit in the bytes left, and a chunk
+ * can not hold more elements than it has bytes.
+ *
+ * @throw InvalidDataException if the directory does not add up, or a
+ * chunk is not read to its end
+ * @throw EndOfFileException if the chunks are not all there
+ */
+template <typename Prepare, typename ReadChunk>
+void read_chunks(BinaryStreamReader & reader, unsigned threads, Prepare prepare,
+		 ReadChunk read_chunk)
+{
+  size_t count = read_length(reader);
+  size_t chunk_count = read_length(reader);
+
+  // the directory is read entry by entry, so a bad chunk count runs
+  // into the end of the data rather than allocating for it up front
+  std::vector<size_t> firsts, sizes, offsets;
+  size_t elements = 0, bytes = 0;
+  for (size_t i = 0; i < chunk_count && !reader.failed(); ++i)
+    {
+      size_t n = read_length(reader);
+      size_t size = read_length(reader);
+      if (n > count - elements || n > size || size > ~bytes)
+	{
+	  reader.report_error(read_invalid_data, InvalidDataException());
+	  return;
+	}
+      firsts.push_back(elements);
+      sizes.push_back(size);
+      offsets.push_back(bytes);
+      elements += n;
+      bytes += size;
+    }
+  if (reader.failed())
+    return;
+  if (elements != count)
+    {
+      reader.report_error(read_invalid_data, InvalidDataException());
+      return;
+    }
+
+  std::vector<char> storage;
+  const char* block = reader.load_block(bytes, storage);
+  if (reader.failed())
+    return;
+
+  prepare(count, chunk_count);
+  firsts.push_back(count);
+  std::vector<ReadError> errors(chunk_count, read_ok);
+  run_chunk_jobs(chunk_count, threads, [&](size_t i) {
+      BinaryStreamReader chunk_reader(block + offsets[i], sizes[i], reader.format());
+      chunk_reader.use_error_codes(reader.uses_error_codes());
+      chunk_reader.track_objects(reader.read_objects().is_tracking());
+      read_chunk(chunk_reader, i, firsts[i], firsts[i + 1] - firsts[i]);
+      if (chunk_reader.bytes_remaining() != 0)
+	chunk_reader.report_error(read_invalid_data, InvalidDataException());
+      errors[i] = chunk_reader.error();
+    });
+
+  // only with error codes, as the readers of the chunks threw otherwise
+  for (ReadError error : errors)
+    if (error != read_ok)
+      {
+	reader.report_error(error, InvalidDataException());
+	return;
+      }
+}
+
+template <typename T, typename Alloc>
+void write_chunked(BinaryStreamWriter & writer, const std::vector<T, Alloc> & elements,
+		   size_t chunk_size, unsigned threads)
+{
+  const T* data = elements.data();
+  write_chunks(writer, elements.size(), chunk_size, threads,
+	       [data](BinaryStreamWriter & chunk_writer, size_t, size_t first, size_t n) {
+		 serialize_elements(chunk_writer, data + first, n);
+	       });
+}
+
+template <typename T, typename Alloc>
+void read_chunked(BinaryStreamReader & reader, std::vector<T, Alloc> & elements, unsigned threads)
+{
+  size_t old_size = elements.size();
+  read_chunks(reader, threads,
+	      [&elements, old_size](size_t count, size_t) { elements.resize(old_size + count); },
+	      [&elements, old_size](BinaryStreamReader & chunk_reader, size_t, size_t first, size_t n) {
+		deserialize_elements(chunk_reader, elements.data() + old_size + first, n);
+	      });
+  if (reader.failed())
+    elements.resize(old_size);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void write_chunked(BinaryStreamWriter & writer, const std::map<K, V, Compare, Alloc> & elements,
+		   size_t chunk_size, unsigned threads)
+{
+  typedef typename std::map<K, V, Compare, Alloc>::const_iterator iterator;
+  if (chunk_size == 0)
+    chunk_size = 1;
+
+  // the first element of every chunk, found in one pass
+  std::vector<iterator> starts;
+  size_t i = 0;
+  for (iterator it = elements.begin(); it != elements.end(); ++it, ++i)
+    if (i % chunk_size == 0)
+      starts.push_back(it);
+
+  write_chunks(writer, elements.size(), chunk_size, threads,
+	       [&starts](BinaryStreamWriter & chunk_writer, size_t chunk, size_t, size_t n) {
+		 iterator it = starts[chunk];
+		 for (size_t j = 0; j < n; ++j, ++it)
+		   chunk_writer<<*it;
+	       });
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void read_chunked(BinaryStreamReader & reader, std::map<K, V, Compare, Alloc> & elements,
+		  unsigned threads)
+{
+  // decoded in parallel, inserted in order; the pairs were written in
+  // key order, so the end() hint makes each insertion constant time
+  std::vector<std::vector<std::pair<K, V> > > decoded;
+  read_chunks(reader, threads,
+	      [&decoded](size_t, size_t chunk_count) { decoded.resize(chunk_count); },
+	      [&decoded](BinaryStreamReader & chunk_reader, size_t chunk, size_t, size_t n) {
+		decoded[chunk].resize(n);
+		deserialize_elements(chunk_reader, decoded[chunk].data(), n);
+	      });
+  if (reader.failed())
+    return;
+  for (std::vector<std::pair<K, V> > & part : decoded)
+    for (std::pair<K, V> & p : part)
+      elements.emplace_hint(elements.end(), std::move(p));
+}
+
+/**
+ * Containers are only written in chunks by a BinaryStreamWriter.
+ */
+template <typename Writer, typename Container>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer & writer, const chunked<Container> & chunks)
+{
+  static_assert(std::is_same<Writer, void>::value, "as_chunks needs a BinaryStreamWriter");
+}
+
+template <typename Container>
+void serialize(BinaryStreamWriter & writer, const chunked<Container> & chunks)
+{
+  write_chunked(writer, chunks.elements, chunks.chunk_size, chunks.threads);
+}
+
+template <typename Reader, typename Container>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader & reader, chunked<Container> & chunks)
+{
+  static_assert(std::is_same<Reader, void>::value, "as_chunks needs a BinaryStreamReader");
+}
+
+template <typename Container>
+void deserialize(BinaryStreamReader & reader, chunked<Container> & chunks)
+{
+  read_chunked(reader, chunks.elements, chunks.threads);
+}
+
+/**
+ * Allows reading into the temporary returned by as_chunks.
+ */
+template <typename Reader, typename Container>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value, Reader&>::type
+operator>>(Reader & reader, chunked<Container> && chunks)
+{
+  return reader>>chunks;
+}
+
+#endif // CHUNKS_HPP
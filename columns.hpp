@@ -0,0 +1,261 @@
+/**
+ * @file   columns.hpp
+ *
+ * @brief Column-oriented encoding of vectors of classes declared with
+ * SERIALIZE_MEMBERS (see members.hpp).
+ *
+ * A vector written as usual interleaves the members of each element.
+ * Wrapped with as_columns, it is written member by member instead:
+ *
+ * writer<<as_columns(points);
+ * reader>>as_columns(points_read);
+ *
+ * The format is the number of elements (see write_length) followed by one
+ * column per member, in the order listed:
+ *
+ *  - arithmetic members: the values of all elements, written with
+ *    serialize_elements, so a binary writer copies them as one block,
+ *  - strings: the lengths of all of them (uint64_t values, also with
+ *    serialize_elements), then all their characters as a single string,
+ *  - other members: the value of each element in turn.
+ *
+ * This is not compatible with writing the vector itself; both sides
+ * have to use as_columns. As with vectors, elements read are appended,
+ * and the vector grows as they are read rather than by the stored
+ * number up front.
+ */
+
+#ifndef COLUMNS_HPP
+#define COLUMNS_HPP
+#include "members.hpp"
+#include "stl_serialize.hpp"
+#include "exceptions.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A vector to be written or read column by column. Made by as_columns.
+ */
+template <typename Vector>
+struct columns
+{
+  Vector & rows;		/**< the vector, const when writing */
+};
+
+template <typename T, typename Alloc>
+columns<const std::vector<T, Alloc> > as_columns(const std::vector<T, Alloc> & rows)
+{
+  return columns<const std::vector<T, Alloc> > {rows};
+}
+
+template <typename T, typename Alloc>
+columns<std::vector<T, Alloc> > as_columns(std::vector<T, Alloc> & rows)
+{
+  return columns<std::vector<T, Alloc> > {rows};
+}
+
+/**
+ * Members written as a lengths column and one block of characters.
+ */
+template <typename T>
+struct is_char_string: std::false_type
+{
+};
+
+template <typename Traits, typename Alloc>
+struct is_char_string<std::basic_string<char, Traits, Alloc> >: std::true_type
+{
+};
+
+template <typename Writer, typename C, typename M>
+typename std::enable_if<std::is_arithmetic<M>::value>::type
+serialize_column(Writer & writer, const C* rows, size_t count, M C::* member)
+{
+  std::unique_ptr<M[]> column(new M[count]);
+  for (size_t i = 0; i < count; ++i)
+    column[i] = rows[i].*member;
+  serialize_elements(writer, column.get(), count);
+}
+
+template <typename Writer, typename C, typename M>
+typename std::enable_if<is_char_string<M>::value>::type
+serialize_column(Writer & writer, const C* rows, size_t count, M C::* member)
+{
+  std::unique_ptr<uint64_t[]> lengths(new uint64_t[count]);
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i)
+    {
+      lengths[i] = (rows[i].*member).size();
+      total += lengths[i];
+    }
+  std::string characters;
+  characters.reserve(total);
+  for (size_t i = 0; i < count; ++i)
+    characters.append((rows[i].*member).data(), lengths[i]);
+
+  serialize_elements(writer, lengths.get(), count);
+  writer<<characters;
+}
+
+template <typename Writer, typename C, typename M>
+typename std::enable_if<!std::is_arithmetic<M>::value && !is_char_string<M>::value>::type
+serialize_column(Writer & writer, const C* rows, size_t count, M C::* member)
+{
+  for (size_t i = 0; i < count; ++i)
+    writer<<(rows[i].*member);
+}
+
+/**
+ * Serialize `count' objects, one column per member given, in order.
+ * Called by the `serialize_columns' functions generated by
+ * SERIALIZE_MEMBERS.
+ *
+ * @param writer Derived StreamWriter instance
+ * @param rows first object
+ * @param count number of objects
+ * @param members pointers to the members to write
+ */
+template <typename Writer, typename C, typename... Members>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize_member_columns(Writer & writer, const C* rows, size_t count, Members... members)
+{
+  int in_order[] = {0, ((void)serialize_column(writer, rows, count, members), 0)...};
+  (void)in_order;
+}
+
+/**
+ * Make sure there are at least `size' rows. The rows are only added
+ * while the first column is read, as many at a time as presize_limit
+ * allows, since the stored count may be corrupt.
+ */
+template <typename C, typename Alloc>
+void grow_rows(std::vector<C, Alloc> & rows, size_t size)
+{
+  if (rows.size() < size)
+    rows.resize(size);
+}
+
+template <typename Reader, typename C, typename Alloc, typename M>
+typename std::enable_if<std::is_arithmetic<M>::value>::type
+deserialize_column(Reader & reader, std::vector<C, Alloc> & rows, size_t first, size_t count,
+		   M C::* member)
+{
+  size_t done = 0;
+  while (done < count && !reader.failed())
+    {
+      size_t batch = presize_limit(reader, count - done, sizeof(M));
+      grow_rows(rows, first + done + batch);
+      std::unique_ptr<M[]> column(new M[batch]);
+      deserialize_elements(reader, column.get(), batch);
+      for (size_t i = 0; i < batch; ++i)
+	rows[first + done + i].*member = column[i];
+      done += batch;
+    }
+}
+
+/**
+ * @throw SizeMismatchException if the lengths do not add up to the
+ * number of characters stored
+ */
+template <typename Reader, typename C, typename Alloc, typename M>
+typename std::enable_if<is_char_string<M>::value>::type
+deserialize_column(Reader & reader, std::vector<C, Alloc> & rows, size_t first, size_t count,
+		   M C::* member)
+{
+  std::vector<uint64_t> lengths;
+  while (lengths.size() < count && !reader.failed())
+    {
+      size_t done = lengths.size();
+      size_t batch = presize_limit(reader, count - done, sizeof(uint64_t));
+      grow_rows(rows, first + done + batch);
+      lengths.resize(done + batch);
+      deserialize_elements(reader, lengths.data() + done, batch);
+    }
+  std::string characters;
+  reader>>characters;
+  if (reader.failed())
+    return;
+
+  size_t offset = 0;
+  for (size_t i = 0; i < count; ++i)
+    {
+      if (lengths[i] > characters.size() - offset)
+	{
+	  reader.report_error(read_size_mismatch,
+			      SizeMismatchException(characters.size(), offset + lengths[i]));
+	  return;
+	}
+      (rows[first + i].*member).assign(characters.data() + offset, lengths[i]);
+      offset += lengths[i];
+    }
+  if (offset != characters.size())
+    reader.report_error(read_size_mismatch, SizeMismatchException(characters.size(), offset));
+}
+
+template <typename Reader, typename C, typename Alloc, typename M>
+typename std::enable_if<!std::is_arithmetic<M>::value && !is_char_string<M>::value>::type
+deserialize_column(Reader & reader, std::vector<C, Alloc> & rows, size_t first, size_t count,
+		   M C::* member)
+{
+  size_t done = 0;
+  while (done < count && !reader.failed())
+    {
+      size_t batch = presize_limit(reader, count - done, sizeof(M));
+      grow_rows(rows, first + done + batch);
+      for (size_t i = 0; i < batch; ++i)
+	reader>>(rows[first + done + i].*member);
+      done += batch;
+    }
+}
+
+/**
+ * Deserialize `count' objects written by serialize_member_columns
+ * into `rows', from row `first' on, adding the rows as they are read.
+ */
+template <typename Reader, typename C, typename Alloc, typename... Members>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize_member_columns(Reader & reader, std::vector<C, Alloc> & rows, size_t first,
+			   size_t count, Members... members)
+{
+  int in_order[] = {0, ((void)deserialize_column(reader, rows, first, count, members), 0)...};
+  (void)in_order;
+}
+
+template <typename Writer, typename Vector>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer & writer, const columns<Vector> & columns_data)
+{
+  typedef typename std::remove_const<Vector>::type::value_type T;
+  static_assert(std::is_same<typename T::serialized_members::object_type, T>::value,
+		"as_columns needs a class declaring its members with SERIALIZE_MEMBERS");
+  size_t count = columns_data.rows.size();
+  write_length(writer, count);
+  serialize_columns(writer, columns_data.rows.data(), count);
+}
+
+template <typename Reader, typename Vector>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader & reader, columns<Vector> & columns_data)
+{
+  size_t count = read_length(reader);
+  size_t old_size = columns_data.rows.size();
+  deserialize_columns(reader, columns_data.rows, old_size, count);
+  if (reader.failed())
+    columns_data.rows.resize(old_size);
+}
+
+/**
+ * Allows reading into the temporary returned by as_columns.
+ */
+template <typename Reader, typename Vector>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value, Reader&>::type
+operator>>(Reader & reader, columns<Vector> && columns_data)
+{
+  return reader>>columns_data;
+}
+
+#endif // COLUMNS_HPP
@@ -7,8 +7,10 @@
 
 #ifndef _SERIALIZE_COMMON_HPP
 #define _SERIALIZE_COMMON_HPP
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <type_traits>
 
 #include "exceptions.hpp"
 
@@ -36,6 +38,75 @@ inline void NOT_IMPLEMENTED(std::string msg)
 }
 
 
+/**
+ * Types whose serialized binary form is exactly their in-memory
+ * representation, so that a contiguous run of them can be written or
+ * read as one block of bytes instead of element by element.
+ *
+ * Only arithmetic types qualify by default. Classes are excluded even
+ * when trivially copyable, since their user-defined `serialize' may
+ * not write every member (or may write them in another order).
+ */
+template <typename T>
+struct is_bulk_serializable:
+  std::integral_constant<bool, std::is_arithmetic<T>::value
+			 && std::is_trivially_copyable<T>::value>
+{
+};
+
+/**
+ * Options of the binary format, combined with |. They change what is
+ * written, so a BinaryStreamReader must be constructed with the same
+ * options as the BinaryStreamWriter which wrote the data.
+ */
+enum BinaryFormat: unsigned
+{
+  binary_native = 0,		/**< everything as raw in-memory bytes, full type keys */
+  binary_type_ids = 1u << 0,	/**< type key written on first use only, then a small integer id */
+  binary_varint = 1u << 1,	/**< integers (including all sizes) as varints, signed ones zigzag-encoded */
+  binary_portable = 1u << 2	/**< fixed-width little-endian values, readable on any host (see byte_order.hpp) */
+};
+
+inline BinaryFormat operator|(BinaryFormat a, BinaryFormat b)
+{
+  return static_cast<BinaryFormat>(static_cast<unsigned>(a) | static_cast<unsigned>(b));
+}
+
+/**
+ * Integer types which binary_varint writes as varints. Single-byte
+ * types (char, bool) gain nothing from it and are written as they are.
+ */
+template <typename T>
+struct is_varint_encoded:
+  std::integral_constant<bool, std::is_integral<T>::value && (sizeof(T) > 1)>
+{
+};
+
+/**
+ * Zigzag encoding maps signed integers to unsigned ones so that
+ * values of small magnitude, negative or not, become small varints:
+ * 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+ */
+inline uint64_t zigzag_encode(int64_t value)
+{
+  return value < 0 ? ~(static_cast<uint64_t>(value) << 1)
+		   : static_cast<uint64_t>(value) << 1;
+}
+
+inline int64_t zigzag_decode(uint64_t value)
+{
+  return (value & 1) ? static_cast<int64_t>(~(value >> 1))
+		     : static_cast<int64_t>(value >> 1);
+}
+
+/**
+ * Number of bytes in the LEB128 varint encoding of a value.
+ */
+constexpr size_t varint_size(uint64_t value)
+{
+  return value < 0x80 ? 1 : 1 + varint_size(value >> 7);
+}
+
 bool check_eof(istream* stream)
 {
 	return stream->eof();
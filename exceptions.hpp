@@ -10,6 +10,8 @@
 #ifndef EXCEPTION_HPP
 #define EXCEPTION_HPP
 
+#include <cstddef>
+#include <cstdio>
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -42,6 +44,51 @@ public:
 	}
 }; 
 
+/**
+ * Exception to be thrown when the data read cannot have been written
+ * by the matching writer, eg. a reference to a type id which was
+ * never defined.
+ */
+class InvalidDataException: public StreamException
+{
+public:
+	virtual const char* what() const throw(){
+		return "Invalid data in stream.";
+	}
+};
+
+/**
+ * Exception to be thrown when a file cannot be opened or mapped into
+ * memory.
+ */
+class FileMappingException: public StreamException
+{
+public:
+  FileMappingException(const string & path):
+    m_message("Could not map file into memory: " + path)
+  {
+  }
+
+  virtual const char* what() const throw(){
+    return m_message.c_str();
+  }
+
+private:
+  string m_message;
+};
+
+/**
+ * Exception to be thrown when a zero-copy view is requested from a
+ * reader which is not reading from memory.
+ */
+class ViewUnavailableException: public StreamException
+{
+public:
+  virtual const char* what() const throw(){
+    return "Views can only be read from memory-backed readers.";
+  }
+};
+
 /**
  * Exception to be thrown when the size of a stored array does not
  * match size of the array trying to be read into.
@@ -59,20 +106,52 @@ public:
   {
   }
     
+  /** 
+   * The message is formatted into the exception itself, so that the
+   * pointer returned stays valid and nothing is allocated.
+   */
   virtual const char* what() const throw(){
     if (m_given_size == m_expected_size)
       return "Size mismatch: Length of stored and receiving objects not equal.";
-    
-    stringstream ss (stringstream::in | stringstream::out);
-    ss<<"Size mismatch!";
-    ss<<"\nExpected length of object was ("<<m_expected_size;
-    ss<<"), and given length is ("<<m_given_size<<").";
 
-    return ss.str().c_str();
+    std::snprintf(m_message, sizeof(m_message),
+		  "Size mismatch!\nExpected length of object was (%zu), and given length is (%zu).",
+		  m_expected_size, m_given_size);
+    return m_message;
   }
 
   private:
   size_t m_expected_size;	/**< expected array size (stored size) */
   size_t m_given_size;		/**< given array size (during deserializing) */
+  mutable char m_message[128];	/**< what(), formatted when asked for */
 };
+
+/**
+ * Errors recorded by a reader using error codes instead of exceptions
+ * (see StreamReader::use_error_codes). Each stands for the exception
+ * which would have been thrown otherwise.
+ */
+enum ReadError
+{
+  read_ok = 0,			/**< no error */
+  read_end_of_file,		/**< EndOfFileException: the data ended too early */
+  read_fail,			/**< FailBitException: the stream could not be read */
+  read_invalid_data,		/**< InvalidDataException */
+  read_size_mismatch,		/**< SizeMismatchException */
+  read_type_not_registered	/**< TypeNotRegisteredException */
+};
+
+inline const char* read_error_message(ReadError error)
+{
+  switch (error)
+    {
+    case read_ok: return "No error.";
+    case read_end_of_file: return "End of file reached.";
+    case read_fail: return "Fail bit exception.";
+    case read_invalid_data: return "Invalid data in stream.";
+    case read_size_mismatch: return "Size mismatch: Length of stored and receiving objects not equal.";
+    case read_type_not_registered: return "A derived class type was not registered.";
+    }
+  return "Unknown error.";
+}
 #endif
@@ -0,0 +1,306 @@
+/**
+ * @file   fixed_size.hpp
+ *
+ * @brief Compile-time size of the binary encoding of types made only of
+ * fundamentals and fixed-size arrays, and the writer and reader used to
+ * encode and decode objects of such types in one step.
+ *
+ * The size of arithmetic types and arrays of them is known. For a
+ * class it comes from SERIALIZE_MEMBERS (see members.hpp), or else has
+ * to be declared, by listing the types of the members in the order
+ * `serialize' writes them:
+ *
+ * struct point { int x, y; double w[3]; };
+ * template <> struct fixed_binary_size<point>:
+ *   fixed_binary_size_of<int, int, double[3]> { };
+ *
+ * BinaryStreamWriter and BinaryStreamReader then reserve the whole
+ * object with a single bounds check and run `serialize'/`deserialize'
+ * against a FixedBinaryWriter/FixedBinaryReader, whose member offsets
+ * are all constants once inlined. Only the binary_native and
+ * binary_type_ids formats take this path; with binary_varint or
+ * binary_portable the size is no longer fixed or no longer the
+ * in-memory one.
+ */
+
+#ifndef FIXED_SIZE_HPP
+#define FIXED_SIZE_HPP
+#include "streamwriter.hpp"
+#include "streamreader.hpp"
+#include "exceptions.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Bytes in the native binary encoding of T, or 0 if that depends on
+ * the value or is not known.
+ */
+template <typename T, typename Enable = void>
+struct fixed_binary_size: std::integral_constant<size_t, 0>
+{
+};
+
+template <typename T>
+struct fixed_binary_size<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>:
+  std::integral_constant<size_t, sizeof(T)>
+{
+};
+
+/**
+ * Arrays are written as their length (a uint64_t) followed by the
+ * elements.
+ */
+template <typename T>
+struct fixed_binary_size<T, typename std::enable_if<std::is_array<T>::value>::type>:
+  std::integral_constant<size_t,
+			 fixed_binary_size<typename std::remove_extent<T>::type>::value == 0 ? 0
+			 : sizeof(uint64_t) + std::extent<T>::value
+			 * fixed_binary_size<typename std::remove_extent<T>::type>::value>
+{
+};
+
+/**
+ * Sum of the sizes of the given member types, or 0 if any of them
+ * does not have a fixed size.
+ */
+template <typename... Members>
+struct fixed_binary_size_of;
+
+template <>
+struct fixed_binary_size_of<>: std::integral_constant<size_t, 0>
+{
+};
+
+template <typename First, typename... Rest>
+struct fixed_binary_size_of<First, Rest...>:
+  std::integral_constant<size_t,
+			 fixed_binary_size<First>::value == 0
+			 || (sizeof...(Rest) > 0 && fixed_binary_size_of<Rest...>::value == 0) ? 0
+			 : fixed_binary_size<First>::value + fixed_binary_size_of<Rest...>::value>
+{
+};
+
+/**
+ * Standard library types written as their parts with nothing in
+ * between (see stl_serialize.hpp); std::array like a built-in array.
+ */
+template <typename T1, typename T2>
+struct fixed_binary_size<std::pair<T1, T2> >: fixed_binary_size_of<T1, T2>
+{
+};
+
+template <typename... Ts>
+struct fixed_binary_size<std::tuple<Ts...> >: fixed_binary_size_of<Ts...>
+{
+};
+
+template <typename T, size_t N>
+struct fixed_binary_size<std::array<T, N> >:
+  std::integral_constant<size_t, fixed_binary_size<T>::value == 0 ? 0
+			 : sizeof(uint64_t) + N * fixed_binary_size<T>::value>
+{
+};
+
+/**
+ * Classes declaring their members with SERIALIZE_MEMBERS (see
+ * members.hpp) get the size of those members. Classes derived from
+ * them do not inherit it.
+ */
+template <typename T>
+struct fixed_binary_size<T, typename std::enable_if<
+			      std::is_same<typename T::serialized_members::object_type, T>::value>::type>:
+  std::integral_constant<size_t, T::serialized_members::fixed_size>
+{
+};
+
+/**
+ * Largest object encoded in one step; larger ones would need too much
+ * stack when the writer or reader has no buffer to encode in place.
+ */
+const size_t max_fixed_object_size = 4096;
+
+/**
+ * Classes which BinaryStreamWriter and BinaryStreamReader encode and
+ * decode in one step.
+ */
+template <typename T>
+struct is_fixed_size_object:
+  std::integral_constant<bool, std::is_class<T>::value
+			 && fixed_binary_size<T>::value != 0
+			 && fixed_binary_size<T>::value <= max_fixed_object_size>
+{
+};
+
+/**
+ * Writes one fixed-size object into `size' bytes reserved for it, in
+ * the binary_native format. Every write checks against `size', but as
+ * the offsets and sizes are constants the checks fold away.
+ */
+class FixedBinaryWriter: public StreamWriter
+{
+public:
+  FixedBinaryWriter(char* out, size_t size):
+    StreamWriter(), out(out), size(size), offset(0)
+  {
+  }
+
+  ~FixedBinaryWriter()
+  {
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_fundamental<T>::value>::type
+  save(const T & T_data)
+  {
+    write_bytes(&T_data, sizeof(T_data));
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_class<T>::value>::type
+  save(const T & T_data)
+  {
+  }
+
+  // never of fixed size
+  void save(const std::string &) = delete;
+
+  template <typename T>
+  typename std::enable_if<std::is_array<T>::value>::type
+  save(const T & T_data)
+  {
+    size_t length = std::extent<T>::value;
+    write_length(*this, length);
+    serialize_elements(*this, T_data, length);
+  }
+
+  template <typename T>
+  typename std::enable_if<is_bulk_serializable<T>::value>::type
+  save_elements(const T* data, size_t count)
+  {
+    write_bytes(data, count * sizeof(T));
+  }
+
+  /**
+   * @throw SizeMismatchException unless exactly `size' bytes were
+   * written, ie. the declared fixed_binary_size was wrong
+   */
+  void check_complete() const
+  {
+    if (offset != size)
+      throw SizeMismatchException(size, offset);
+  }
+
+private:
+  void write_bytes(const void* data, size_t count)
+  {
+    if (count > size - offset)
+      throw SizeMismatchException(size, offset + count);
+    std::memcpy(out + offset, data, count);
+    offset += count;
+  }
+
+  char* out;			/**< start of the reserved bytes */
+  size_t size;			/**< number of reserved bytes */
+  size_t offset;		/**< bytes written so far */
+};
+
+template <typename T>
+typename std::enable_if<is_bulk_serializable<T>::value>::type
+serialize_elements(FixedBinaryWriter & writer, const T* data, size_t count)
+{
+  writer.save_elements(data, count);
+}
+
+/**
+ * Reads one fixed-size object out of `size' bytes, the counterpart of
+ * FixedBinaryWriter.
+ */
+class FixedBinaryReader: public StreamReader
+{
+public:
+  FixedBinaryReader(const char* in, size_t size):
+    StreamReader(), in(in), size(size), offset(0)
+  {
+  }
+
+  ~FixedBinaryReader()
+  {
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_fundamental<T>::value>::type
+  load(T & T_data)
+  {
+    read_bytes(&T_data, sizeof(T_data));
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_class<T>::value>::type
+  load(T & T_data)
+  {
+  }
+
+  void load(std::string &) = delete;
+
+  /**
+   * The elements are read even if the stored length is wrong (with
+   * error codes), as the size of the object does not depend on it.
+   *
+   * @throw SizeMismatchException if the stored length is not the
+   * length of the array
+   */
+  template <typename T>
+  typename std::enable_if<std::is_array<T>::value>::type
+  load(T & T_data)
+  {
+    size_t array_size = std::extent<T>::value;
+    size_t stored_array_size = read_length(*this);
+    if (stored_array_size != array_size)
+      report_error(read_size_mismatch, SizeMismatchException(stored_array_size, array_size));
+    deserialize_elements(*this, T_data, array_size);
+  }
+
+  template <typename T>
+  typename std::enable_if<is_bulk_serializable<T>::value>::type
+  load_elements(T* data, size_t count)
+  {
+    read_bytes(data, count * sizeof(T));
+  }
+
+  /**
+   * @throw SizeMismatchException unless exactly `size' bytes were read
+   */
+  void check_complete() const
+  {
+    if (offset != size)
+      throw SizeMismatchException(size, offset);
+  }
+
+private:
+  void read_bytes(void* data, size_t count)
+  {
+    if (count > size - offset)
+      throw SizeMismatchException(size, offset + count);
+    std::memcpy(data, in + offset, count);
+    offset += count;
+  }
+
+  const char* in;		/**< start of the object's bytes */
+  size_t size;			/**< number of bytes in the object */
+  size_t offset;		/**< bytes read so far */
+};
+
+template <typename T>
+typename std::enable_if<is_bulk_serializable<T>::value>::type
+deserialize_elements(FixedBinaryReader & reader, T* data, size_t count)
+{
+  reader.load_elements(data, count);
+}
+
+#endif
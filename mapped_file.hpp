@@ -0,0 +1,104 @@
+/**
+ * @file   mapped_file.hpp
+ * 
+ * @brief Read-only memory mapping of a file, so that an archive
+ * written by BinaryStreamWriter can be deserialized in place instead
+ * of being copied through an ifstream buffer.
+ *
+ * eg.
+ * MappedFile file("archive.bin");
+ * BinaryStreamReader reader(file.data(), file.size());
+ * reader>>obj;
+ *
+ * POSIX only.
+ */
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "exceptions.hpp"
+
+/**
+ * Maps a whole file read-only for the lifetime of the object. Readers
+ * constructed from data() and size() must not outlive it.
+ *
+ * The kernel is advised that the mapping will be read sequentially,
+ * so pages are read ahead and can be dropped once read.
+ */
+class MappedFile
+{
+public:
+  /** 
+   * Map the file at `path'.
+   *
+   * @param path path of the file to map
+   * @throw FileMappingException if the file cannot be opened or mapped
+   */
+  explicit MappedFile(const std::string & path):
+    m_data(nullptr), m_size(0)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw FileMappingException(path);
+
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0)
+      {
+	::close(fd);
+	throw FileMappingException(path);
+      }
+
+    m_size = file_stat.st_size;
+    if (m_size > 0)
+      {
+	void* mapping = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED)
+	  {
+	    ::close(fd);
+	    throw FileMappingException(path);
+	  }
+	m_data = static_cast<const char*>(mapping);
+	::posix_madvise(mapping, m_size, POSIX_MADV_SEQUENTIAL);
+      }
+
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  /** 
+   * Unmaps the file. Views obtained from readers over this mapping
+   * become invalid.
+   */
+  ~MappedFile()
+  {
+    if (m_data)
+      ::munmap(const_cast<char*>(m_data), m_size);
+  }
+
+  /** 
+   * @return start of the mapped file contents
+   */
+  const char* data() const { return m_data; }
+
+  /** 
+   * @return size of the file in bytes
+   */
+  size_t size() const { return m_size; }
+
+private:
+  const char* m_data;		/**< start of the mapping, null for an empty file */
+  size_t m_size;		/**< size of the mapping in bytes */
+};
+
+#endif // MAPPED_FILE_HPP
@@ -0,0 +1,654 @@
+/**
+ * @file   benchmark.cpp
+ *
+ * @brief Encoding and decoding throughput of the text and binary
+ * formats, on datasets generated at startup from a fixed seed so that
+ * every run (and every build) measures the same bytes.
+ *
+ * Build and run from the top directory:
+ *
+ *   make bench
+ *   ./benchmark.o [--repetitions N] [--warmup N] [--scale X]
+ *                 [--seed N] [--filter TEXT] [--json FILE]
+ *
+ * Each case is encoded and decoded `warmup' times untimed, then
+ * `repetitions' times timed. The decoded data is compared with the
+ * original once, so a broken format cannot report good numbers.
+ * Reported are the minimum, median, 90th and 99th percentile and
+ * maximum times, and throughput in MB/s and objects/s at the median.
+ * Only the << or >> of the dataset is timed (and the flush of the
+ * writer); setting up the stream or buffer, and destroying the
+ * decoded data, are not.
+ *
+ * --json writes the same results in a form which can be diffed across
+ * builds; the output sizes in it only change if the format does.
+ */
+
+#include "../text_streamwriter.hpp"
+#include "../text_streamreader.hpp"
+#include "../binary_streamwriter.hpp"
+#include "../binary_streamreader.hpp"
+#include "../members.hpp"
+#include "../columns.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+using namespace std;
+
+/**
+ * xorshift64* generator: the same sequence on every platform, unlike
+ * the standard distributions.
+ */
+class generator
+{
+public:
+  explicit generator(uint64_t seed): state(seed ? seed : 1)
+  {
+  }
+
+  uint64_t next()
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+  }
+
+  /**
+   * @return integer in [low, high]
+   */
+  int64_t range(int64_t low, int64_t high)
+  {
+    return low + static_cast<int64_t>(next() % static_cast<uint64_t>(high - low + 1));
+  }
+
+  /**
+   * @return number in [0, 1), with 53 random bits
+   */
+  double unit()
+  {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  string word(size_t min_length, size_t max_length)
+  {
+    string w(static_cast<size_t>(range(min_length, max_length)), ' ');
+    for (size_t i = 0; i < w.size(); ++i)
+      w[i] = static_cast<char>('a' + range(0, 25));
+    return w;
+  }
+
+private:
+  uint64_t state;
+};
+
+/**
+ * Separate fundamentals, each written with its own <<.
+ */
+struct fundamentals
+{
+  vector<int> ints;
+  vector<double> doubles;
+  vector<char> chars;
+
+  bool operator==(const fundamentals & f) const
+  {
+    return ints == f.ints && doubles == f.doubles && chars == f.chars;
+  }
+};
+
+template <class Writer>
+void serialize(Writer & w, const fundamentals & f)
+{
+  w<<f.ints.size();
+  for (size_t i = 0; i < f.ints.size(); ++i)
+    w<<f.ints[i]<<f.doubles[i]<<f.chars[i];
+}
+
+template <class Reader>
+void deserialize(Reader & r, fundamentals & f)
+{
+  size_t count;
+  r>>count;
+  f.ints.resize(count);
+  f.doubles.resize(count);
+  f.chars.resize(count);
+  for (size_t i = 0; i < count; ++i)
+    r>>f.ints[i]>>f.doubles[i]>>f.chars[i];
+}
+
+struct record
+{
+  int id;
+  short kind;
+  double score;
+  double weight;
+  string name;
+  vector<short> tags;
+  SERIALIZE_MEMBERS(record, id, kind, score, weight, name, tags)
+
+  bool operator==(const record & r) const
+  {
+    return id == r.id && kind == r.kind && score == r.score && weight == r.weight
+      && name == r.name && tags == r.tags;
+  }
+};
+
+/**
+ * The same records, written column by column (see columns.hpp).
+ */
+struct record_columns
+{
+  vector<record> rows;
+
+  bool operator==(const record_columns & c) const
+  {
+    return rows == c.rows;
+  }
+};
+
+template <class Writer>
+void serialize(Writer & w, const record_columns & c)
+{
+  w<<as_columns(c.rows);
+}
+
+template <class Reader>
+void deserialize(Reader & r, record_columns & c)
+{
+  r>>as_columns(c.rows);
+}
+
+struct shape
+{
+  double x, y;
+  shape(): x(0), y(0) { }
+  virtual ~shape() { }
+  virtual bool equals(const shape & s) const = 0;
+};
+
+struct circle: public shape
+{
+  double radius;
+  circle(): radius(0) { }
+  bool equals(const shape & s) const
+  {
+    const circle* c = dynamic_cast<const circle*>(&s);
+    return c && c->x == x && c->y == y && c->radius == radius;
+  }
+};
+
+struct rectangle: public shape
+{
+  double width, height;
+  string label;
+  rectangle(): width(0), height(0) { }
+  bool equals(const shape & s) const
+  {
+    const rectangle* r = dynamic_cast<const rectangle*>(&s);
+    return r && r->x == x && r->y == y && r->width == width && r->height == height
+      && r->label == label;
+  }
+};
+
+template <class Writer>
+void serialize(Writer & w, const circle & c)
+{
+  w<<c.x<<c.y<<c.radius;
+}
+
+template <class Reader>
+void deserialize(Reader & r, circle & c)
+{
+  r>>c.x>>c.y>>c.radius;
+}
+
+template <class Writer>
+void serialize(Writer & w, const rectangle & rect)
+{
+  w<<rect.x<<rect.y<<rect.width<<rect.height<<rect.label;
+}
+
+template <class Reader>
+void deserialize(Reader & r, rectangle & rect)
+{
+  r>>rect.x>>rect.y>>rect.width>>rect.height>>rect.label;
+}
+
+typedef vector<unique_ptr<shape> > shapes;
+
+bool same_data(const shapes & a, const shapes & b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i)
+    if (!a[i]->equals(*b[i]))
+      return false;
+  return true;
+}
+
+template <typename Data>
+bool same_data(const Data & a, const Data & b)
+{
+  return a == b;
+}
+
+enum format_kind
+  {
+    text_stream,		/**< TextStreamWriter on a stringstream */
+    binary_stream,		/**< buffered BinaryStreamWriter on a stringstream */
+    binary_memory,		/**< BinaryStreamWriter appending to a vector */
+    binary_memory_varint	/**< the same, with binary_varint */
+  };
+
+const format_kind all_formats[] = {text_stream, binary_stream, binary_memory, binary_memory_varint};
+
+const char* format_name(format_kind format)
+{
+  switch (format)
+    {
+    case text_stream: return "text";
+    case binary_stream: return "binary";
+    case binary_memory: return "binary_memory";
+    case binary_memory_varint: return "binary_memory_varint";
+    }
+  return "";
+}
+
+typedef chrono::steady_clock benchmark_clock;
+
+double seconds_since(benchmark_clock::time_point start)
+{
+  return chrono::duration<double>(benchmark_clock::now() - start).count();
+}
+
+/**
+ * Encode `data', leaving the encoding in `bytes'.
+ *
+ * @return seconds taken
+ */
+template <typename Data>
+double encode(format_kind format, const Data & data, vector<char> & bytes)
+{
+  bytes.clear();
+  double seconds = 0;
+  if (format == text_stream || format == binary_stream)
+    {
+      ostringstream os;
+      {
+	TextStreamWriter text_writer(os);
+	BinaryStreamWriter binary_writer(os, 64 * 1024);
+	benchmark_clock::time_point start = benchmark_clock::now();
+	if (format == text_stream)
+	  text_writer<<data;
+	else
+	  {
+	    binary_writer<<data;
+	    binary_writer.flush();
+	  }
+	seconds = seconds_since(start);
+      }
+      string s = os.str();
+      bytes.assign(s.begin(), s.end());
+    }
+  else
+    {
+      BinaryStreamWriter writer(bytes, format == binary_memory_varint ? binary_varint : binary_native);
+      benchmark_clock::time_point start = benchmark_clock::now();
+      writer<<data;
+      writer.flush();
+      seconds = seconds_since(start);
+    }
+  return seconds;
+}
+
+/**
+ * Decode `bytes' into `data'.
+ *
+ * @return seconds taken
+ */
+template <typename Data>
+double decode(format_kind format, const vector<char> & bytes, Data & data)
+{
+  benchmark_clock::time_point start;
+  if (format == text_stream || format == binary_stream)
+    {
+      istringstream is(string(bytes.begin(), bytes.end()));
+      if (format == text_stream)
+	{
+	  TextStreamReader reader(is);
+	  start = benchmark_clock::now();
+	  reader>>data;
+	}
+      else
+	{
+	  BinaryStreamReader reader(is);
+	  start = benchmark_clock::now();
+	  reader>>data;
+	}
+      return seconds_since(start);
+    }
+
+  BinaryStreamReader reader(bytes.data(), bytes.size(),
+			    format == binary_memory_varint ? binary_varint : binary_native);
+  start = benchmark_clock::now();
+  reader>>data;
+  return seconds_since(start);
+}
+
+struct settings
+{
+  int repetitions;
+  int warmup;
+  double scale;
+  uint64_t seed;
+  string filter;
+  string json_file;
+};
+
+struct timing
+{
+  double min, p50, p90, p99, max, mean;
+};
+
+struct result
+{
+  string case_name;
+  string format;
+  string operation;		/**< "encode" or "decode" */
+  size_t bytes;			/**< size of the encoding */
+  size_t objects;		/**< objects in the dataset */
+  timing seconds;
+  bool verified;		/**< decoded data matched the original */
+};
+
+/**
+ * Nearest-rank percentile of sorted times.
+ */
+double percentile(const vector<double> & sorted, double fraction)
+{
+  size_t rank = static_cast<size_t>(ceil(fraction * sorted.size()));
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+timing summarize(vector<double> times)
+{
+  sort(times.begin(), times.end());
+  timing t;
+  t.min = times.front();
+  t.p50 = percentile(times, 0.5);
+  t.p90 = percentile(times, 0.9);
+  t.p99 = percentile(times, 0.99);
+  t.max = times.back();
+  double total = 0;
+  for (size_t i = 0; i < times.size(); ++i)
+    total += times[i];
+  t.mean = total / times.size();
+  return t;
+}
+
+/**
+ * Time encoding and decoding `data' in every format.
+ */
+template <typename Data>
+void run_case(const string & name, const Data & data, size_t objects,
+	      const settings & s, vector<result> & results)
+{
+  for (format_kind format : all_formats)
+    {
+      string id = name + "/" + format_name(format);
+      if (id.find(s.filter) == string::npos)
+	continue;
+
+      vector<char> bytes;
+      vector<double> encode_times, decode_times;
+      for (int rep = -s.warmup; rep < s.repetitions; ++rep)
+	{
+	  double t = encode(format, data, bytes);
+	  if (rep >= 0)
+	    encode_times.push_back(t);
+	}
+
+      bool verified = false;
+      for (int rep = -s.warmup; rep < s.repetitions; ++rep)
+	{
+	  Data decoded;
+	  double t = decode(format, bytes, decoded);
+	  if (rep >= 0)
+	    decode_times.push_back(t);
+	  if (rep == -s.warmup)
+	    verified = same_data(data, decoded);
+	}
+      if (!verified)
+	cerr<<id<<": decoded data does not match"<<endl;
+
+      result r = {name, format_name(format), "encode", bytes.size(), objects,
+		  summarize(encode_times), verified};
+      results.push_back(r);
+      r.operation = "decode";
+      r.seconds = summarize(decode_times);
+      results.push_back(r);
+    }
+}
+
+size_t scaled(size_t count, const settings & s)
+{
+  return max(static_cast<size_t>(1), static_cast<size_t>(count * s.scale));
+}
+
+void run_all(const settings & s, vector<result> & results)
+{
+  generator gen(s.seed);
+
+  fundamentals f;
+  size_t n = scaled(100000, s);
+  for (size_t i = 0; i < n; ++i)
+    {
+      f.ints.push_back(static_cast<int>(gen.range(-1000000, 1000000)));
+      f.doubles.push_back(gen.unit() * 1000);
+      f.chars.push_back(static_cast<char>(gen.range('a', 'z')));
+    }
+  run_case("fundamentals", f, 3 * n, s, results);
+
+  vector<int> ints(scaled(1000000, s));
+  for (size_t i = 0; i < ints.size(); ++i)
+    ints[i] = static_cast<int>(gen.range(-1000000, 1000000));
+  run_case("int_vector", ints, ints.size(), s, results);
+
+  vector<double> doubles(scaled(500000, s));
+  for (size_t i = 0; i < doubles.size(); ++i)
+    doubles[i] = (gen.unit() - 0.5) * 1e6;
+  run_case("double_vector", doubles, doubles.size(), s, results);
+
+  vector<string> strings(scaled(100000, s));
+  for (size_t i = 0; i < strings.size(); ++i)
+    strings[i] = gen.word(1, 16);
+  run_case("string_vector", strings, strings.size(), s, results);
+
+  map<string, int> words;
+  size_t map_size = scaled(50000, s);
+  while (words.size() < map_size)
+    words[gen.word(4, 12)] = static_cast<int>(gen.range(0, 1000000));
+  run_case("string_int_map", words, words.size(), s, results);
+
+  record_columns records;
+  records.rows.resize(scaled(50000, s));
+  for (size_t i = 0; i < records.rows.size(); ++i)
+    {
+      record & r = records.rows[i];
+      r.id = static_cast<int>(i);
+      r.kind = static_cast<short>(gen.range(0, 7));
+      r.score = gen.unit() * 100;
+      r.weight = gen.unit();
+      r.name = gen.word(3, 20);
+      r.tags.resize(static_cast<size_t>(gen.range(0, 4)));
+      for (size_t j = 0; j < r.tags.size(); ++j)
+	r.tags[j] = static_cast<short>(gen.range(0, 1000));
+    }
+  run_case("records", records.rows, records.rows.size(), s, results);
+  run_case("records_columnar", records, records.rows.size(), s, results);
+
+  shapes scene(scaled(50000, s));
+  for (size_t i = 0; i < scene.size(); ++i)
+    {
+      if (gen.range(0, 1))
+	{
+	  circle* c = new circle;
+	  c->radius = gen.unit() * 10;
+	  scene[i].reset(c);
+	}
+      else
+	{
+	  rectangle* r = new rectangle;
+	  r->width = gen.unit() * 10;
+	  r->height = gen.unit() * 10;
+	  r->label = gen.word(0, 8);
+	  scene[i].reset(r);
+	}
+      scene[i]->x = gen.unit() * 1000;
+      scene[i]->y = gen.unit() * 1000;
+    }
+  run_case("polymorphic", scene, scene.size(), s, results);
+}
+
+void register_types()
+{
+  ostringstream os;
+  istringstream is;
+  TextStreamWriter text_writer(os);
+  TextStreamReader text_reader(is);
+  BinaryStreamWriter binary_writer(os);
+  BinaryStreamReader binary_reader(is);
+  REGISTER_TYPE(text_writer, circle);
+  REGISTER_TYPE(text_writer, rectangle);
+  REGISTER_TYPE(text_reader, circle);
+  REGISTER_TYPE(text_reader, rectangle);
+  REGISTER_TYPE(binary_writer, circle);
+  REGISTER_TYPE(binary_writer, rectangle);
+  REGISTER_TYPE(binary_reader, circle);
+  REGISTER_TYPE(binary_reader, rectangle);
+}
+
+double megabytes_per_second(const result & r)
+{
+  return r.bytes / 1e6 / r.seconds.p50;
+}
+
+double objects_per_second(const result & r)
+{
+  return r.objects / r.seconds.p50;
+}
+
+void print_table(const vector<result> & results)
+{
+  cout<<left<<setw(18)<<"case"<<setw(22)<<"format"<<setw(8)<<"op"
+      <<right<<setw(11)<<"bytes"<<setw(11)<<"p50 ms"<<setw(11)<<"p90 ms"
+      <<setw(11)<<"MB/s"<<setw(14)<<"objects/s"<<endl;
+  for (const result & r : results)
+    cout<<left<<setw(18)<<r.case_name<<setw(22)<<r.format<<setw(8)<<r.operation
+	<<right<<setw(11)<<r.bytes<<fixed<<setprecision(3)
+	<<setw(11)<<r.seconds.p50 * 1e3<<setw(11)<<r.seconds.p90 * 1e3
+	<<setprecision(1)<<setw(11)<<megabytes_per_second(r)
+	<<setprecision(0)<<setw(14)<<objects_per_second(r)
+	<<(r.verified ? "" : "  MISMATCH")<<endl;
+}
+
+void write_json(ostream & os, const settings & s, const vector<result> & results)
+{
+  os<<setprecision(9);
+  os<<"{\n";
+  os<<"  \"compiler\": \""<<__VERSION__<<"\",\n";
+  os<<"  \"cplusplus\": "<<__cplusplus<<",\n";
+#ifdef __OPTIMIZE__
+  os<<"  \"optimized\": true,\n";
+#else
+  os<<"  \"optimized\": false,\n";
+#endif
+  os<<"  \"settings\": {\"repetitions\": "<<s.repetitions<<", \"warmup\": "<<s.warmup
+    <<", \"scale\": "<<s.scale<<", \"seed\": "<<s.seed<<"},\n";
+  os<<"  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i)
+    {
+      const result & r = results[i];
+      os<<(i ? ",\n" : "\n");
+      os<<"    {\"case\": \""<<r.case_name<<"\", \"format\": \""<<r.format
+	<<"\", \"operation\": \""<<r.operation<<"\", \"bytes\": "<<r.bytes
+	<<", \"objects\": "<<r.objects<<", \"verified\": "<<(r.verified ? "true" : "false")
+	<<",\n     \"seconds\": {\"min\": "<<r.seconds.min<<", \"p50\": "<<r.seconds.p50
+	<<", \"p90\": "<<r.seconds.p90<<", \"p99\": "<<r.seconds.p99
+	<<", \"max\": "<<r.seconds.max<<", \"mean\": "<<r.seconds.mean<<"},"
+	<<"\n     \"mb_per_s\": "<<megabytes_per_second(r)
+	<<", \"objects_per_s\": "<<objects_per_second(r)<<"}";
+    }
+  os<<"\n  ]\n}\n";
+}
+
+void usage()
+{
+  cerr<<"usage: benchmark.o [--repetitions N] [--warmup N] [--scale X] [--seed N]"
+      <<" [--filter TEXT] [--json FILE]"<<endl;
+  exit(2);
+}
+
+int main(int argc, char** argv)
+{
+  settings s = {10, 2, 1.0, 20121204, "", ""};
+  for (int i = 1; i < argc; ++i)
+    {
+      string option = argv[i];
+      if (i + 1 == argc)
+	usage();
+      const char* value = argv[++i];
+      if (option == "--repetitions")
+	s.repetitions = atoi(value);
+      else if (option == "--warmup")
+	s.warmup = atoi(value);
+      else if (option == "--scale")
+	s.scale = atof(value);
+      else if (option == "--seed")
+	s.seed = strtoull(value, nullptr, 10);
+      else if (option == "--filter")
+	s.filter = value;
+      else if (option == "--json")
+	s.json_file = value;
+      else
+	usage();
+    }
+  if (s.repetitions < 1 || s.warmup < 0 || !(s.scale > 0))
+    usage();
+
+  register_types();
+  vector<result> results;
+  run_all(s, results);
+  print_table(results);
+
+  if (!s.json_file.empty())
+    {
+      ofstream json(s.json_file);
+      write_json(json, s, results);
+      if (!json)
+	{
+	  cerr<<"could not write "<<s.json_file<<endl;
+	  return 1;
+	}
+    }
+
+  for (const result & r : results)
+    if (!r.verified)
+      return 1;
+  return 0;
+}
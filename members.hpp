@@ -0,0 +1,135 @@
+/**
+ * @file   members.hpp
+ *
+ * @brief The SERIALIZE_MEMBERS macro, which generates the `serialize'
+ * and `deserialize' functions of a class from a list of its members.
+ *
+ * eg.
+ * class point
+ * {
+ *   int x, y;
+ *   std::string label;
+ * public:
+ *   SERIALIZE_MEMBERS(point, x, y, label)
+ * };
+ *
+ * Members are written and read in the order listed, so the two
+ * functions cannot disagree. Each member may be anything the << and >>
+ * operators handle. Base classes are not included; a class with a
+ * serialized base still needs hand-written functions.
+ */
+
+#ifndef MEMBERS_HPP
+#define MEMBERS_HPP
+#include "fixed_size.hpp"
+#include <cstddef>
+#include <vector>
+
+/**
+ * The class and member types given to SERIALIZE_MEMBERS. If all
+ * members have a fixed size, so has the class (see fixed_size.hpp).
+ */
+template <typename Class, typename... Members>
+struct member_list
+{
+  typedef Class object_type;
+  static const size_t fixed_size = fixed_binary_size_of<Members...>::value;
+};
+
+// SERIALIZE_PP_MAP(f, c, a, b, ...) expands to f(c, a), f(c, b), ...
+// for up to 32 arguments.
+#define SERIALIZE_PP_CAT(a, b) SERIALIZE_PP_CAT_(a, b)
+#define SERIALIZE_PP_CAT_(a, b) a##b
+
+#define SERIALIZE_PP_NARGS(...)						\
+  SERIALIZE_PP_NARGS_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, \
+		      16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define SERIALIZE_PP_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, \
+			    _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, \
+			    N, ...) N
+
+#define SERIALIZE_PP_MAP(f, c, ...)					\
+  SERIALIZE_PP_CAT(SERIALIZE_PP_MAP_, SERIALIZE_PP_NARGS(__VA_ARGS__))(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_1(f, c, x) f(c, x)
+#define SERIALIZE_PP_MAP_2(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_1(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_3(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_2(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_4(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_3(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_5(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_4(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_6(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_5(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_7(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_6(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_8(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_7(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_9(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_8(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_10(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_9(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_11(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_10(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_12(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_11(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_13(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_12(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_14(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_13(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_15(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_14(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_16(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_15(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_17(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_16(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_18(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_17(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_19(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_18(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_20(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_19(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_21(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_20(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_22(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_21(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_23(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_22(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_24(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_23(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_25(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_24(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_26(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_25(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_27(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_26(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_28(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_27(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_29(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_28(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_30(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_29(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_31(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_30(f, c, __VA_ARGS__)
+#define SERIALIZE_PP_MAP_32(f, c, x, ...) f(c, x), SERIALIZE_PP_MAP_31(f, c, __VA_ARGS__)
+
+#define SERIALIZE_PP_MEMBER_TYPE(type, member) decltype(type::member)
+#define SERIALIZE_PP_MEMBER_POINTER(type, member) &type::member
+
+/**
+ * Generates `serialize' and `deserialize' for `type' from the list of
+ * its members (up to 32), as friends so that private members may be
+ * listed. Must appear inside the class, after the members.
+ *
+ * With BinaryStreamWriter and BinaryStreamReader, arithmetic members
+ * adjacent in memory are written and read as a single block, and a
+ * class made only of fixed-size members is encoded in one step.
+ *
+ * Also generates `serialize_columns' and `deserialize_columns', which
+ * vectors of the class wrapped with as_columns use (see columns.hpp).
+ */
+#define SERIALIZE_MEMBERS(type, ...)					\
+  typedef member_list<type, SERIALIZE_PP_MAP(SERIALIZE_PP_MEMBER_TYPE, type, __VA_ARGS__)> \
+  serialized_members;							\
+  template <typename, typename> friend struct fixed_binary_size;	\
+									\
+  template <class Writer>						\
+  friend void serialize(Writer & writer, const type & object)		\
+  {									\
+    serialize_members(writer, object,					\
+		      SERIALIZE_PP_MAP(SERIALIZE_PP_MEMBER_POINTER, type, __VA_ARGS__)); \
+  }									\
+									\
+  template <class Reader>						\
+  friend void deserialize(Reader & reader, type & object)		\
+  {									\
+    deserialize_members(reader, object,					\
+			SERIALIZE_PP_MAP(SERIALIZE_PP_MEMBER_POINTER, type, __VA_ARGS__)); \
+  }									\
+									\
+  template <class Writer>						\
+  friend void serialize_columns(Writer & writer, const type* rows, size_t count) \
+  {									\
+    serialize_member_columns(writer, rows, count,			\
+			     SERIALIZE_PP_MAP(SERIALIZE_PP_MEMBER_POINTER, type, __VA_ARGS__)); \
+  }									\
+									\
+  template <class Reader, class Alloc>					\
+  friend void deserialize_columns(Reader & reader, std::vector<type, Alloc> & rows, \
+				  size_t first, size_t count)		\
+  {									\
+    deserialize_member_columns(reader, rows, first, count,		\
+			       SERIALIZE_PP_MAP(SERIALIZE_PP_MEMBER_POINTER, type, __VA_ARGS__)); \
+  }
+
+#endif
@@ -0,0 +1,318 @@
+/**
+ * @file   number_format.hpp
+ * 
+ * @brief Locale-independent conversion of numbers to and from text,
+ * used by TextStreamWriter and TextStreamReader instead of the
+ * iostream << and >> operators.
+ *
+ * Floating point values are written with the fewest digits which read
+ * back to exactly the same value. With C++17 (and a standard library
+ * providing them) std::to_chars / std::from_chars are used; otherwise
+ * fallbacks based on printf-style conversion, made to use the "C"
+ * locale whatever the global one with POSIX uselocale(). These write
+ * the same digits, but may pick fixed notation where to_chars picks
+ * an exponent (see format_number).
+ */
+
+#ifndef NUMBER_FORMAT_HPP
+#define NUMBER_FORMAT_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#if defined(__cpp_lib_to_chars)
+#define SERIALIZE_HAVE_TO_CHARS 1
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef SERIALIZE_HAVE_TO_CHARS
+#include <locale.h>
+#if defined(__APPLE__)
+#include <xlocale.h>
+#endif
+#endif
+
+/**
+ * Longest text produced by format_number, for any type.
+ */
+const size_t max_number_length = 64;
+
+/**
+ * Types written as numbers by the text format. Character types and
+ * bool are written as they are by the iostream operators instead.
+ */
+template <typename T>
+struct is_text_number:
+  std::integral_constant<bool, std::is_floating_point<T>::value
+			 || (std::is_integral<T>::value
+			     && !std::is_same<T, bool>::value
+			     && !std::is_same<T, char>::value
+			     && !std::is_same<T, signed char>::value
+			     && !std::is_same<T, unsigned char>::value
+			     && !std::is_same<T, wchar_t>::value
+			     && !std::is_same<T, char16_t>::value
+			     && !std::is_same<T, char32_t>::value)>
+{
+};
+
+/**
+ * Whitespace separating numbers, the same set as isspace() in the "C"
+ * locale: ' ' and '\t' '\n' '\v' '\f' '\r' (9 to 13).
+ */
+inline bool is_number_space(int c)
+{
+  return c == ' ' || static_cast<unsigned>(c - '\t') <= '\r' - '\t';
+}
+
+#if defined(__SSE2__)
+// Bit i set if p[i] is whitespace, for 16 characters at once.
+inline unsigned space_mask(const char* p)
+{
+  const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  const __m128i blank = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+  const __m128i control = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+  const __m128i range = _mm_set1_epi8('\r' - '\t');
+  const __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(control, range), control);
+  return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(blank, in_range)));
+}
+
+inline unsigned lowest_bit(unsigned mask)
+{
+  return static_cast<unsigned>(__builtin_ctz(mask));
+}
+#endif
+
+/**
+ * First whitespace character in [p, end), or end if there is none.
+ * Classifies 16 characters per step where SSE2 is available.
+ */
+inline const char* find_number_space(const char* p, const char* end)
+{
+#if defined(__SSE2__)
+  for (; end - p >= 16; p += 16)
+    {
+      unsigned mask = space_mask(p);
+      if (mask)
+	return p + lowest_bit(mask);
+    }
+#endif
+  while (p != end && !is_number_space(static_cast<unsigned char>(*p)))
+    ++p;
+  return p;
+}
+
+/**
+ * First non-whitespace character in [p, end), or end if there is none.
+ */
+inline const char* skip_number_space(const char* p, const char* end)
+{
+#if defined(__SSE2__)
+  for (; end - p >= 16; p += 16)
+    {
+      unsigned mask = ~space_mask(p) & 0xffffu;
+      if (mask)
+	return p + lowest_bit(mask);
+    }
+#endif
+  while (p != end && is_number_space(static_cast<unsigned char>(*p)))
+    ++p;
+  return p;
+}
+
+#ifndef SERIALIZE_HAVE_TO_CHARS
+/**
+ * Makes the calling thread use the "C" locale for numbers while it
+ * exists, so that the printf and strtod conversions write and expect
+ * a '.' whatever LC_NUMERIC is. Other threads are not affected.
+ */
+class c_numeric_locale
+{
+public:
+  c_numeric_locale(): previous(uselocale(c_locale()))
+  {
+  }
+
+  ~c_numeric_locale()
+  {
+    uselocale(previous);
+  }
+
+  c_numeric_locale(const c_numeric_locale&) = delete;
+  c_numeric_locale& operator=(const c_numeric_locale&) = delete;
+
+private:
+  static locale_t c_locale()
+  {
+    static const locale_t c = newlocale(LC_NUMERIC_MASK, "C", static_cast<locale_t>(0));
+    return c;
+  }
+
+  locale_t previous;		/**< locale of the thread before */
+};
+#endif
+
+// strtof/strtod/strtold chosen by the type of the last argument
+inline float string_to_float(const char* text, char** end, float*)
+{
+  return std::strtof(text, end);
+}
+
+inline double string_to_float(const char* text, char** end, double*)
+{
+  return std::strtod(text, end);
+}
+
+inline long double string_to_float(const char* text, char** end, long double*)
+{
+  return std::strtold(text, end);
+}
+
+/**
+ * Parse an integer which must occupy all of [first, last).
+ *
+ * @return true on success, false if the text is not a valid number or
+ * does not fit in T.
+ */
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, bool>::type
+parse_number(const char* first, const char* last, T & value)
+{
+#ifdef SERIALIZE_HAVE_TO_CHARS
+  std::from_chars_result result = std::from_chars(first, last, value);
+  return result.ec == std::errc() && result.ptr == last;
+#else
+  typedef typename std::make_unsigned<T>::type U;
+  bool negative = first != last && *first == '-';
+  if (negative && !std::is_signed<T>::value)
+    return false;
+  if (negative)
+    ++first;
+  if (first == last)
+    return false;
+
+  U limit = negative ? U(0) - static_cast<U>(std::numeric_limits<T>::min())
+    : static_cast<U>(std::numeric_limits<T>::max());
+  U magnitude = 0;
+  for (; first != last; ++first)
+    {
+      unsigned digit = static_cast<unsigned char>(*first) - '0';
+      if (digit > 9 || magnitude > (limit - digit) / 10)
+	return false;
+      magnitude = magnitude * 10 + digit;
+    }
+  value = negative ? static_cast<T>(U(0) - magnitude) : static_cast<T>(magnitude);
+  return true;
+#endif
+}
+
+/**
+ * Parse a floating point number which must occupy all of [first, last).
+ */
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, bool>::type
+parse_number(const char* first, const char* last, T & value)
+{
+#ifdef SERIALIZE_HAVE_TO_CHARS
+  std::from_chars_result result = std::from_chars(first, last, value);
+  return result.ec == std::errc() && result.ptr == last;
+#else
+  size_t len = last - first;
+  if (len == 0 || len >= max_number_length)
+    return false;
+  char text[max_number_length];
+  std::memcpy(text, first, len);
+  text[len] = '\0';
+
+  c_numeric_locale c_locale;
+  char* end;
+  value = string_to_float(text, &end, static_cast<T*>(nullptr));
+  return end == text + len;
+#endif
+}
+
+/**
+ * Integers in decimal, with a leading '-' if negative.
+ *
+ * @param out buffer of at least max_number_length characters
+ * @param value number to format
+ *
+ * @return number of characters written (not NUL-terminated)
+ */
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, size_t>::type
+format_number(char* out, T value)
+{
+#ifdef SERIALIZE_HAVE_TO_CHARS
+  return std::to_chars(out, out + max_number_length, value).ptr - out;
+#else
+  typedef typename std::make_unsigned<T>::type U;
+  char digits[max_number_length];
+  size_t ndigits = 0;
+  bool negative = value < 0;
+  U magnitude = negative ? U(0) - static_cast<U>(value) : static_cast<U>(value);
+  do
+    {
+      digits[ndigits++] = static_cast<char>('0' + magnitude % 10);
+      magnitude /= 10;
+    }
+  while (magnitude != 0);
+
+  size_t len = 0;
+  if (negative)
+    out[len++] = '-';
+  while (ndigits > 0)
+    out[len++] = digits[--ndigits];
+  return len;
+#endif
+}
+
+/**
+ * Floating point numbers with the fewest significant digits which
+ * read back to the same value. Without std::to_chars, the printf %g
+ * notation is used, which chooses between fixed and exponent forms
+ * differently (eg. 100000000 rather than 1e+08); either reads back the
+ * same.
+ */
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, size_t>::type
+format_number(char* out, T value)
+{
+#ifdef SERIALIZE_HAVE_TO_CHARS
+  return std::to_chars(out, out + max_number_length, value).ptr - out;
+#else
+  // Numbers of up to digits10 digits survive decimal -> binary ->
+  // decimal, so they come back from that precision with the trailing
+  // zeros dropped; past it, take the fewest digits which read back to
+  // the same value, max_digits10 always being enough. Subnormals have
+  // fewer bits, so their shortest form may be shorter than digits10
+  // would make it: they are tried from a single digit.
+  c_numeric_locale c_locale;
+  long double extended = value;
+  int len = 0;
+  int first_precision = std::fpclassify(value) == FP_SUBNORMAL ? 1
+    : std::numeric_limits<T>::digits10;
+  for (int precision = first_precision;
+       precision <= std::numeric_limits<T>::max_digits10; ++precision)
+    {
+      len = std::snprintf(out, max_number_length, "%.*Lg", precision, extended);
+      T parsed;
+      if (parse_number(out, out + len, parsed) && parsed == value)
+	break;
+    }
+  return len;
+#endif
+}
+
+#endif // NUMBER_FORMAT_HPP
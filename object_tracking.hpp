@@ -0,0 +1,255 @@
+/**
+ * @file   object_tracking.hpp
+ *
+ * @brief Tables of the objects written and read through pointers, so
+ * that an object pointed to several times is written only once and
+ * read back as a single object.
+ *
+ * Every pointer written through the tracking tables is preceded by a
+ * reference number (a size_t):
+ *
+ *  - 0 for a null pointer,
+ *  - the next unused number (1 for the first object) for an object
+ *    written for the first time, which follows,
+ *  - the number of an object written earlier, which is not written
+ *    again.
+ *
+ * An object is numbered before its contents are written, so a cycle
+ * refers back to it rather than recursing forever.
+ */
+
+#ifndef OBJECT_TRACKING_HPP
+#define OBJECT_TRACKING_HPP
+
+#include "exceptions.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Address of the complete object pointed to, which is the same
+ * whichever base class the pointer is to.
+ */
+template <typename T>
+typename std::enable_if<std::is_polymorphic<T>::value, const void*>::type
+object_address(const T* object)
+{
+  return dynamic_cast<const void*>(object);
+}
+
+template <typename T>
+typename std::enable_if<!std::is_polymorphic<T>::value, const void*>::type
+object_address(const T* object)
+{
+  return object;
+}
+
+/**
+ * Dynamic type of the object pointed to.
+ */
+template <typename T>
+typename std::enable_if<std::is_polymorphic<T>::value, std::type_index>::type
+object_type(const T* object)
+{
+  return typeid(*object);
+}
+
+template <typename T>
+typename std::enable_if<!std::is_polymorphic<T>::value, std::type_index>::type
+object_type(const T*)
+{
+  return typeid(T);
+}
+
+/**
+ * Objects written so far, identified by their address and type (a
+ * struct and its first member have the same address).
+ */
+class WrittenObjects
+{
+public:
+  WrittenObjects(): tracking(false), count(0)
+  {
+  }
+
+  /**
+   * Number every object written, but only look objects up when
+   * tracking. Without tracking, each pointer is written out in full.
+   */
+  void set_tracking(bool enable)
+  {
+    tracking = enable;
+  }
+
+  bool is_tracking() const
+  {
+    return tracking;
+  }
+
+  /**
+   * Reference number for an object about to be written.
+   *
+   * @param address object_address() of the object
+   * @param type dynamic type of the object
+   * @param is_new set to true if the object has to be written
+   * (ie. it was not written before)
+   *
+   * @return the object's reference number
+   */
+  size_t reference(const void* address, std::type_index type, bool & is_new)
+  {
+    is_new = true;
+    if (!tracking)
+      return ++count;
+
+    auto inserted = ids.emplace(key_type(address, type), count + 1);
+    if (!inserted.second)
+      {
+	is_new = false;
+	return inserted.first->second;
+      }
+    return ++count;
+  }
+
+private:
+  typedef std::pair<const void*, std::type_index> key_type;
+
+  struct key_hash
+  {
+    size_t operator()(const key_type & k) const
+    {
+      return std::hash<const void*>()(k.first) ^ (k.second.hash_code() << 1);
+    }
+  };
+
+  bool tracking;		/**< whether objects are looked up */
+  size_t count;			/**< objects numbered so far */
+  std::unordered_map<key_type, size_t, key_hash> ids; /**< numbers of objects written, when tracking */
+};
+
+/**
+ * Objects read so far, by reference number.
+ */
+class ReadObjects
+{
+public:
+  ReadObjects(): tracking(false)
+  {
+  }
+
+  void set_tracking(bool enable)
+  {
+    tracking = enable;
+  }
+
+  bool is_tracking() const
+  {
+    return tracking;
+  }
+
+  /**
+   * @return the reference number the next new object will have
+   */
+  size_t next_reference() const
+  {
+    return objects.size() + 1;
+  }
+
+  /**
+   * Number a newly constructed object, before its contents are read.
+   *
+   * @param address the object
+   * @param owner shared_ptr owning it, if any
+   * @param unique whether a unique_ptr owns it
+   */
+  void add(void* address, std::shared_ptr<void> owner, bool unique)
+  {
+    objects.push_back(entry{address, std::move(owner), unique});
+  }
+
+  /**
+   * Whether `reference' is an object read earlier which can be given
+   * another pointer: any object for a raw pointer, one not owned by a
+   * unique_ptr for a shared_ptr, and one with no owner at all for a
+   * unique_ptr. The other functions throw when this is false.
+   */
+  bool can_refer(size_t reference, bool shared, bool unique) const
+  {
+    if (reference == 0 || reference > objects.size())
+      return false;
+    const entry & e = objects[reference - 1];
+    if (unique)
+      return !e.unique && !e.owner;
+    return !shared || !e.unique;
+  }
+
+  /**
+   * The object with a given reference number, read earlier.
+   *
+   * @throw InvalidDataException if there is no such object
+   */
+  void* address(size_t reference)
+  {
+    return get(reference).address;
+  }
+
+  /**
+   * An object read earlier, to be owned by a unique_ptr.
+   *
+   * @throw InvalidDataException if the object already has an owner
+   */
+  void* take_unique(size_t reference)
+  {
+    entry & e = get(reference);
+    if (e.unique || e.owner)
+      throw InvalidDataException();
+    e.unique = true;
+    return e.address;
+  }
+
+  /**
+   * shared_ptr to an object read earlier, sharing ownership with
+   * every other shared_ptr to it. An object first read through a raw
+   * pointer becomes owned by the shared_ptr; the raw pointer must not
+   * be deleted.
+   *
+   * @throw InvalidDataException if the object is owned by a unique_ptr
+   */
+  template <typename T>
+  std::shared_ptr<T> shared(size_t reference)
+  {
+    entry & e = get(reference);
+    if (e.unique)
+      throw InvalidDataException();
+    T* object = static_cast<T*>(e.address);
+    if (!e.owner)
+      e.owner = std::shared_ptr<T>(object);
+    return std::shared_ptr<T>(e.owner, object);
+  }
+
+private:
+  struct entry
+  {
+    void* address;		/**< the object */
+    std::shared_ptr<void> owner; /**< shared ownership of it, if any */
+    bool unique;		/**< owned by a unique_ptr */
+  };
+
+  entry & get(size_t reference)
+  {
+    if (reference == 0 || reference > objects.size())
+      throw InvalidDataException();
+    return objects[reference - 1];
+  }
+
+  bool tracking;		/**< whether raw pointers carry reference numbers */
+  std::vector<entry> objects;	/**< objects read, by reference number - 1 */
+};
+
+#endif // OBJECT_TRACKING_HPP
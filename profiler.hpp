@@ -0,0 +1,274 @@
+/**
+ * @file   profiler.hpp
+ *
+ * @brief Per-type accounting of calls, bytes and time spent
+ * serializing and deserializing, to find which type makes an archive
+ * large or a load slow.
+ *
+ * Only compiled in when SERIALIZE_PROFILE is defined (in every
+ * translation unit, before including any of the library's headers).
+ * Otherwise the hooks expand to nothing and readers and writers have
+ * no profiler member at all.
+ *
+ * eg.
+ * #define SERIALIZE_PROFILE
+ * ...
+ * Profiler profile;
+ * BinaryStreamWriter w(os);
+ * w.set_profiler(&profile);
+ * w<<data;
+ * profile.report(std::cerr);
+ *
+ * Every << and >> records the type it was called for, and every
+ * polymorphic object additionally the key it was registered with.
+ * As these nest (a class around its members), each type gets both
+ * inclusive figures and `self' figures which exclude nested calls; the
+ * self figures add up to the total. Bytes are the change in the
+ * writer's or reader's position(), so they are 0 for streams which
+ * cannot report a position (eg. pipes).
+ */
+
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+/**
+ * Calls, bytes and time per type, collected from the readers and
+ * writers it is attached to.
+ */
+class Profiler
+{
+public:
+  /**
+   * Figures for one type or registered key.
+   */
+  struct entry
+  {
+    std::string name;		/**< readable type name, or registered key */
+    bool registered_key;	/**< name is the key of a polymorphic type */
+    uint64_t calls;		/**< number of << or >> */
+    uint64_t bytes;		/**< bytes written or read, including nested calls */
+    uint64_t self_bytes;	/**< bytes excluding nested calls */
+    double seconds;		/**< time, including nested calls */
+    double self_seconds;	/**< time excluding nested calls */
+  };
+
+  /**
+   * Start of a << or >>, at `position' in the output or input.
+   */
+  void enter(size_t position)
+  {
+    frame f = {clock::now(), position, 0, 0};
+    stack.push_back(f);
+  }
+
+  /**
+   * End of the innermost << or >> for a type.
+   */
+  void leave(const std::type_info & type, size_t position)
+  {
+    add(types[std::type_index(type)], position);
+  }
+
+  /**
+   * End of the innermost << or >> for a registered polymorphic type.
+   */
+  void leave(const std::string & key, size_t position)
+  {
+    add(keys[key], position);
+  }
+
+  /**
+   * @return the figures for every type seen, most self bytes first
+   * (then most self time)
+   */
+  std::vector<entry> entries() const
+  {
+    std::vector<entry> all;
+    for (auto & t : types)
+      all.push_back(make_entry(type_name(t.first.name()), false, t.second));
+    for (auto & k : keys)
+      all.push_back(make_entry(k.first, true, k.second));
+    std::sort(all.begin(), all.end(), [](const entry & a, const entry & b) {
+	return a.self_bytes != b.self_bytes ? a.self_bytes > b.self_bytes
+	  : a.self_seconds > b.self_seconds;
+      });
+    return all;
+  }
+
+  /**
+   * Print a table of entries(), one line per type, with the type name
+   * last as it may be long.
+   */
+  void report(std::ostream & os) const
+  {
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os<<std::setw(12)<<"calls"<<std::setw(14)<<"self bytes"<<std::setw(14)<<"bytes"
+      <<std::setw(12)<<"self ms"<<std::setw(12)<<"ms"<<"  type ([registered key])\n";
+    for (const entry & e : entries())
+      os<<std::setw(12)<<e.calls<<std::setw(14)<<e.self_bytes<<std::setw(14)<<e.bytes
+	<<std::fixed<<std::setprecision(3)<<std::setw(12)<<e.self_seconds * 1e3
+	<<std::setw(12)<<e.seconds * 1e3<<"  "
+	<<(e.registered_key ? "[" + e.name + "]" : e.name)<<"\n";
+    os.flags(flags);
+    os.precision(precision);
+  }
+
+  /**
+   * Forget everything recorded so far.
+   */
+  void clear()
+  {
+    types.clear();
+    keys.clear();
+  }
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  struct frame
+  {
+    clock::time_point start;	/**< when the call started */
+    size_t start_position;	/**< position when it started */
+    uint64_t nested_bytes;	/**< bytes of the calls nested in it */
+    double nested_seconds;	/**< time of the calls nested in it */
+  };
+
+  struct totals
+  {
+    uint64_t calls, bytes, self_bytes;
+    double seconds, self_seconds;
+  };
+
+  void add(totals & t, size_t position)
+  {
+    frame f = stack.back();
+    stack.pop_back();
+    double seconds = std::chrono::duration<double>(clock::now() - f.start).count();
+    uint64_t bytes = position > f.start_position ? position - f.start_position : 0;
+
+    t.calls++;
+    t.bytes += bytes;
+    t.self_bytes += bytes > f.nested_bytes ? bytes - f.nested_bytes : 0;
+    t.seconds += seconds;
+    t.self_seconds += seconds > f.nested_seconds ? seconds - f.nested_seconds : 0;
+    if (!stack.empty())
+      {
+	stack.back().nested_bytes += bytes;
+	stack.back().nested_seconds += seconds;
+      }
+  }
+
+  static entry make_entry(const std::string & name, bool registered_key, const totals & t)
+  {
+    entry e = {name, registered_key, t.calls, t.bytes, t.self_bytes, t.seconds, t.self_seconds};
+    return e;
+  }
+
+  static std::string type_name(const char* mangled)
+  {
+#if defined(__GNUG__)
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+    if (status == 0 && demangled)
+      {
+	std::string name(demangled);
+	std::free(demangled);
+	return name;
+      }
+#endif
+    return mangled;
+  }
+
+  std::vector<frame> stack;	/**< calls in progress, innermost last */
+  std::unordered_map<std::type_index, totals> types; /**< figures by type */
+  std::unordered_map<std::string, totals> keys; /**< figures by registered key */
+};
+
+/**
+ * Records one << or >> with the profiler of a reader or writer, if it
+ * has one, from construction to destruction.
+ */
+class ProfileScope
+{
+public:
+  template <typename ReaderWriter>
+  ProfileScope(ReaderWriter & readerwriter, const std::type_info & type):
+    profiler(readerwriter.profiler()), readerwriter(&readerwriter),
+    position_of(&position<ReaderWriter>), type(&type), key(nullptr)
+  {
+    if (profiler)
+      profiler->enter(position<ReaderWriter>(&readerwriter));
+  }
+
+  template <typename ReaderWriter>
+  ProfileScope(ReaderWriter & readerwriter, const std::string & key):
+    profiler(readerwriter.profiler()), readerwriter(&readerwriter),
+    position_of(&position<ReaderWriter>), type(nullptr), key(&key)
+  {
+    if (profiler)
+      profiler->enter(position<ReaderWriter>(&readerwriter));
+  }
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+  ~ProfileScope()
+  {
+    if (!profiler)
+      return;
+    size_t end = position_of(readerwriter);
+    if (type)
+      profiler->leave(*type, end);
+    else
+      profiler->leave(*key, end);
+  }
+
+private:
+  template <typename ReaderWriter>
+  static size_t position(const void* readerwriter)
+  {
+    return static_cast<const ReaderWriter*>(readerwriter)->position();
+  }
+
+  Profiler* profiler;		/**< profiler to record to, or nullptr */
+  const void* readerwriter;	/**< reader or writer recorded */
+  size_t (*position_of)(const void*); /**< its position() */
+  const std::type_info* type;	/**< type recorded, or nullptr */
+  const std::string* key;	/**< or registered key recorded */
+};
+
+#ifdef SERIALIZE_PROFILE
+#define SERIALIZE_PP_PROFILE_CAT(a, b) a##b
+#define SERIALIZE_PP_PROFILE_NAME(line) SERIALIZE_PP_PROFILE_CAT(serialize_profile_scope_, line)
+/**
+ * Profile the rest of the enclosing block as a << or >> of `type' (a
+ * type) or `key' (a registered key) on `readerwriter'.
+ */
+#define SERIALIZE_PROFILE_TYPE(readerwriter, type)			\
+  ProfileScope SERIALIZE_PP_PROFILE_NAME(__LINE__)(readerwriter, typeid(type))
+#define SERIALIZE_PROFILE_KEY(readerwriter, key)			\
+  ProfileScope SERIALIZE_PP_PROFILE_NAME(__LINE__)(readerwriter, key)
+#else
+#define SERIALIZE_PROFILE_TYPE(readerwriter, type)
+#define SERIALIZE_PROFILE_KEY(readerwriter, key)
+#endif
+
+#endif // PROFILER_HPP
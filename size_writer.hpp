@@ -0,0 +1,221 @@
+/**
+ * @file   size_writer.hpp
+ *
+ * @brief A writer which only counts the bytes BinaryStreamWriter
+ * would write, so that an output buffer can be allocated exactly
+ * before the real write.
+ */
+
+#ifndef SIZE_WRITER_HPP
+#define SIZE_WRITER_HPP
+#include "streamwriter.hpp"
+#include "stl_serialize.hpp"
+#include "byte_order.hpp"
+#include "fixed_size.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+
+/**
+ * Runs the same save/serialize overloads as BinaryStreamWriter with
+ * the same BinaryFormat, but writes nothing and only adds up the
+ * number of bytes.
+ *
+ * The size of an arithmetic value, or of an array of them, does not
+ * depend on the value except for varints, so it is a compile-time
+ * constant selected by the format flags. The same goes for classes
+ * declaring a fixed_binary_size.
+ *
+ * Polymorphic types must be registered with the SizeWriter as for any
+ * other writer:
+ *
+ * SizeWriter sizer;
+ * REGISTER_TYPE(sizer, Derived);
+ * sizer<<base_ptr;
+ * buffer.reserve(sizer.size());
+ */
+class SizeWriter: public StreamWriter
+{
+public:
+  /**
+   * @param format options of the binary format to measure
+   */
+  explicit SizeWriter(BinaryFormat format = binary_native):
+    StreamWriter(), format_flags(format), byte_count(0)
+  {
+  }
+
+  ~SizeWriter()
+  {
+  }
+
+  /**
+   * Bytes counted so far.
+   */
+  size_t size() const
+  {
+    return byte_count;
+  }
+
+  /**
+   * The same as size(), for profiling.
+   */
+  size_t position() const
+  {
+    return byte_count;
+  }
+
+  /**
+   * Start counting from zero again. Types already given ids (with
+   * binary_type_ids) are forgotten, as for a new BinaryStreamWriter.
+   */
+  void reset()
+  {
+    byte_count = 0;
+    type_ids.clear();
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_fundamental<T>::value>::type
+  save(const T & T_data)
+  {
+    byte_count += value_size(T_data, is_varint_encoded<T>());
+  }
+
+  template <typename Traits, typename Alloc>
+  void save(const std::basic_string<char, Traits, Alloc> & string_data)
+  {
+    add_string(string_data.size());
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_class<T>::value>::type
+  save(const T &)
+  {
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_polymorphic<T>::value>::type
+  save(T* T_data)
+  {
+    add_type(T_data);
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_array<T>::value>::type
+  save(const T & T_data)
+  {
+    size_t length = std::extent<T>::value;
+    write_length(*this, length);
+    serialize_elements(*this, T_data, length);
+  }
+
+  /**
+   * Count `count' contiguous arithmetic elements, as
+   * BinaryStreamWriter::save_elements writes them. Only varints need
+   * to look at the values.
+   */
+  template <typename T>
+  typename std::enable_if<is_bulk_serializable<T>::value>::type
+  save_elements(const T* data, size_t count)
+  {
+    if (is_varint_encoded<T>::value && (format_flags & binary_varint))
+      {
+	for (size_t i = 0; i < count; ++i)
+	  byte_count += value_size(data[i], std::true_type());
+	return;
+      }
+    byte_count += count * value_size(T(), std::false_type());
+  }
+
+  /**
+   * Objects of fixed size (see fixed_size.hpp) are counted without
+   * visiting their members, unless the format changes their size.
+   */
+  template <typename T>
+  void save_fixed(const T & T_data)
+  {
+    if (format_flags & (binary_varint | binary_portable))
+      {
+	save(T_data);
+	serialize(*this, T_data);
+	return;
+      }
+    byte_count += fixed_binary_size<T>::value;
+  }
+
+private:
+  template <class T>
+  size_t value_size(const T &, std::false_type) const
+  {
+    return (format_flags & binary_portable) ? sizeof(typename portable_type<T>::type)
+      : sizeof(T);
+  }
+
+  template <class T>
+  size_t value_size(const T & T_data, std::true_type) const
+  {
+    if (!(format_flags & binary_varint))
+      return value_size(T_data, std::false_type());
+    if (std::is_signed<T>::value)
+      return varint_size(zigzag_encode(static_cast<int64_t>(T_data)));
+    return varint_size(static_cast<uint64_t>(T_data));
+  }
+
+  void add_string(size_t slen)
+  {
+    byte_count += value_size(static_cast<uint64_t>(slen), std::true_type()) + slen;
+  }
+
+  /**
+   * Same as BinaryStreamWriter::write_type.
+   */
+  template <class T>
+  void add_type(T* T_data)
+  {
+    auto type_info = InfoList<SizeWriter>::get_matching_type(T_data);
+    if (!(format_flags & binary_type_ids))
+      {
+	add_string(type_info->key().size());
+	return;
+      }
+
+    auto id_iter = type_ids.find(type_info);
+    if (id_iter != type_ids.end())
+      {
+	byte_count += varint_size(id_iter->second);
+	return;
+      }
+    size_t id = type_ids.size() + 1;
+    type_ids[type_info] = id;
+    byte_count += varint_size(0);
+    add_string(type_info->key().size());
+  }
+
+  BinaryFormat format_flags;	/**< options of the format measured */
+  size_t byte_count;		/**< bytes counted so far */
+  std::unordered_map<TiedInfoBase<SizeWriter>*, size_t> type_ids; /**< ids given to types so far, with binary_type_ids */
+};
+
+/**
+ * Arrays and vectors of arithmetic types are counted without visiting
+ * every element, unless they are varints.
+ */
+template <typename T>
+typename std::enable_if<is_bulk_serializable<T>::value>::type
+serialize_elements(SizeWriter & writer, const T* data, size_t count)
+{
+  writer.save_elements(data, count);
+}
+
+template <typename T>
+typename std::enable_if<is_fixed_size_object<T>::value, SizeWriter&>::type
+operator<<(SizeWriter & writer, const T & T_data)
+{
+  SERIALIZE_PROFILE_TYPE(writer, T);
+  writer.save_fixed(T_data);
+  return writer;
+}
+
+#endif
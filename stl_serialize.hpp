@@ -6,24 +6,45 @@
 #ifndef STL_SERIALIZE_HPP
 #define STL_SERIALIZE_HPP
 #include "streamwriter.hpp"
+#include <array>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <set>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <utility>
 #include <map>
+#include <memory>
 #include <iostream>
+#if __cplusplus >= 201703L
+#include <optional>
+#include <variant>
+#endif
 
 /** @brief serializes any STL vector
   * by writing the size first
   * and then the vector elements
   * @param reference to a Writer w derived from a StreamWriter and a vector
 */
-template <typename Writer, typename T>
+template <typename Writer, typename T, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+ serialize(Writer& w, const std::vector<T, Alloc> & vec_data) {
+      write_length(w, vec_data.size());
+      serialize_elements(w, vec_data.data(), vec_data.size());
+  }
+
+/** @brief serializes std::vector<bool>, which has no contiguous
+  * storage, one element at a time
+*/
+template <typename Writer, typename Alloc>
 typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
- serialize(Writer& w, const std::vector<T> & vec_data) {
-      size_t vec_size = vec_data.size();
-      //w.stream->write(reinterpret_cast<char*>(&vec_size), sizeof(vec_size));
-      w<<vec_size;
+ serialize(Writer& w, const std::vector<bool, Alloc> & vec_data) {
+      write_length(w, vec_data.size());
       for(auto it = vec_data.begin();it !=vec_data.end();++it) {
         w<<*it;
       }
@@ -43,33 +64,203 @@ serialize(Writer& w, const std::pair<T1, T2>& pair_data) {
  * Serialize std::map
  * write each pair
 */
-template<typename Writer, typename T1, typename T2>
+template<typename Writer, typename T1, typename T2, typename Compare, typename Alloc>
 typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
-serialize(Writer& w, const std::map<T1, T2>& map_data) {
-    size_t map_size = map_data.size();
-    w<<map_size;
-    //cout<<map_size<<endl;
+serialize(Writer& w, const std::map<T1, T2, Compare, Alloc>& map_data) {
+    write_length(w, map_data.size());
     for(auto it = map_data.begin();it !=map_data.end();++it) {
         w<<(*it).first<<(*it).second;
         //cout<<(*it).first<<(*it).second;
     }
   }
 
+/**
+ * Serialize std::unordered_map: the size, then each key and value
+*/
+template<typename Writer, typename K, typename V, typename Hash, typename Eq, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::unordered_map<K, V, Hash, Eq, Alloc>& map_data) {
+    write_length(w, map_data.size());
+    for(auto it = map_data.begin();it !=map_data.end();++it) {
+        w<<(*it).first<<(*it).second;
+    }
+  }
+
+/**
+ * Serialization of the sequence and set containers which have no
+ * contiguous storage: the size, then each element
+*/
+template<typename Writer, typename Container>
+void serialize_sequence(Writer& w, const Container& container_data) {
+    write_length(w, container_data.size());
+    for(auto it = container_data.begin();it !=container_data.end();++it) {
+        w<<*it;
+    }
+  }
+
+template<typename Writer, typename T, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::deque<T, Alloc>& deque_data) {
+    serialize_sequence(w, deque_data);
+  }
+
+template<typename Writer, typename T, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::list<T, Alloc>& list_data) {
+    serialize_sequence(w, list_data);
+  }
+
+template<typename Writer, typename T, typename Compare, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::set<T, Compare, Alloc>& set_data) {
+    serialize_sequence(w, set_data);
+  }
+
+template<typename Writer, typename T, typename Hash, typename Eq, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::unordered_set<T, Hash, Eq, Alloc>& set_data) {
+    serialize_sequence(w, set_data);
+  }
+
+/**
+ * std::array is written like a built-in array: the length, then the
+ * elements, as a single block where the writer allows it
+*/
+template<typename Writer, typename T, size_t N>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::array<T, N>& array_data) {
+    write_length(w, N);
+    serialize_elements(w, array_data.data(), N);
+  }
+
+/**
+ * std::tuple: the elements in order, with nothing in between
+*/
+template<size_t I, size_t N>
+struct tuple_elements
+{
+  template<typename Writer, typename Tuple>
+  static void write(Writer& w, const Tuple& tuple_data) {
+    w<<std::get<I>(tuple_data);
+    tuple_elements<I + 1, N>::write(w, tuple_data);
+  }
+
+  template<typename Reader, typename Tuple>
+  static void read(Reader& r, Tuple& tuple_data) {
+    r>>std::get<I>(tuple_data);
+    tuple_elements<I + 1, N>::read(r, tuple_data);
+  }
+};
+
+template<size_t N>
+struct tuple_elements<N, N>
+{
+  template<typename Writer, typename Tuple>
+  static void write(Writer&, const Tuple&) { }
+
+  template<typename Reader, typename Tuple>
+  static void read(Reader&, Tuple&) { }
+};
+
+template<typename Writer, typename... Ts>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::tuple<Ts...>& tuple_data) {
+    tuple_elements<0, sizeof...(Ts)>::write(w, tuple_data);
+  }
+
+#if __cplusplus >= 201703L
+/**
+ * std::optional: whether there is a value (a bool), then the value
+*/
+template<typename Writer, typename T>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::optional<T>& optional_data) {
+    bool has_value = optional_data.has_value();
+    w<<has_value;
+    if (has_value)
+      w<<*optional_data;
+  }
+
+/**
+ * Index of the alternative held by a std::variant, as written
+*/
+typedef uint16_t variant_index;
+
+/**
+ * std::variant: the index of the alternative held, then its value
+ * @throw std::bad_variant_access if the variant holds no value
+*/
+template<typename Writer, typename... Ts>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::variant<Ts...>& variant_data) {
+    static_assert(sizeof...(Ts) <= 0xffff, "too many alternatives");
+    if (variant_data.valueless_by_exception())
+      throw std::bad_variant_access();
+    variant_index index = static_cast<variant_index>(variant_data.index());
+    w<<index;
+    std::visit([&w](const auto& value) { w<<value; }, variant_data);
+  }
+#endif
+
+
+/**
+ * std::shared_ptr and std::unique_ptr: a reference number, then the
+ * object pointed to unless it was written before (see
+ * object_tracking.hpp). Objects shared by several shared_ptrs are
+ * written once if the writer tracks objects.
+*/
+template<typename Writer, typename T>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::shared_ptr<T>& pointer_data) {
+    write_pointer(w, pointer_data.get());
+  }
+
+template<typename Writer, typename T, typename Deleter>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize(Writer& w, const std::unique_ptr<T, Deleter>& pointer_data) {
+    write_pointer(w, pointer_data.get());
+  }
+
+
+/**
+ * Deserializes a vector by growing it to its final size and reading
+ * every element in place, so there are no copies. Arithmetic elements
+ * can then be filled by the reader with a single read.
+ * As the stored size may be corrupt, the vector grows by no more than
+ * presize_limit elements at a time; with a reader from memory, that is
+ * usually a single step.
+ * Elements are appended if the vector is not empty. With error codes,
+ * this and the other containers below are left empty if the read
+ * fails, rather than holding part of what was stored.
+*/
+template <typename Reader, typename T, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::vector<T, Alloc>& vec_data) {
+      size_t vec_size_read = read_length(r);
+      size_t old_size = vec_data.size();
+      size_t done = 0;
+      while (done < vec_size_read && !r.failed()) {
+        size_t batch = presize_limit(r, vec_size_read - done, sizeof(T));
+        vec_data.resize(old_size + done + batch);
+        deserialize_elements(r, vec_data.data() + old_size + done, batch);
+        done += batch;
+      }
+      if (r.failed())
+        vec_data.clear();
+}
 
-template <typename Reader, typename T>
+template <typename Reader, typename Alloc>
 typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
-deserialize(Reader& r, std::vector<T>& vec_data) {
-      size_t vec_size_read;
-      //r.stream->read(reinterpret_cast<char*>(&vec_size_read), sizeof(vec_size_read));
-      r>>vec_size_read;
-      // check vec_data size here and throw an exception if it is not 0(ie not empty)
-      size_t i;
-      T t;
-      for(i = 0; i<vec_size_read;i++){
-        //r.stream->read(reinterpret_cast<char*>(&t), sizeof(t));
-        r>>t;
-        vec_data.push_back(t);
+deserialize(Reader& r, std::vector<bool, Alloc>& vec_data) {
+      size_t vec_size_read = read_length(r);
+      vec_data.reserve(vec_data.size() + presize_limit(r, vec_size_read, 1));
+      bool b;
+      for(size_t i = 0; i<vec_size_read && !r.failed();i++){
+        r>>b;
+        vec_data.push_back(b);
       }
+      if (r.failed())
+        vec_data.clear();
 }
 
 template <typename Reader, typename T1, typename T2>
@@ -78,20 +269,198 @@ deserialize(Reader& r, std::pair<T1, T2>& pair_data) {
     r>>pair_data.first>>pair_data.second;
 }
 
-template<typename Reader, typename T1, typename T2>
+/**
+ * Deserialize std::map
+ * Each pair is read into a fresh object and moved into the map. The
+ * pairs were written in key order, so inserting with the end() hint
+ * takes amortized constant time per element.
+*/
+template<typename Reader, typename T1, typename T2, typename Compare, typename Alloc>
 typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
-deserialize(Reader& r, std::map<T1, T2>& map_data) {
-    size_t map_size_read;
-    r>>map_size_read;
+deserialize(Reader& r, std::map<T1, T2, Compare, Alloc>& map_data) {
+    size_t map_size_read = read_length(r);
     //check size
-    std::pair<T1, T2> p;
-    std::pair<typename std::map<T1, T2>::iterator,bool> ret;
-    for(auto i = 0; i<map_size_read;i++){
+    for(size_t i = 0; i<map_size_read && !r.failed();i++){
+        std::pair<T1, T2> p;
+        r>>p;
+        map_data.emplace_hint(map_data.end(), std::move(p));
+    }
+    if (r.failed())
+      map_data.clear();
+}
+
+/**
+ * Deserialize std::unordered_map
+ * The table is sized for the elements before any is inserted, so it
+ * is not rehashed (up to presize_limit elements).
+*/
+template<typename Reader, typename K, typename V, typename Hash, typename Eq, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::unordered_map<K, V, Hash, Eq, Alloc>& map_data) {
+    size_t map_size_read = read_length(r);
+    map_data.reserve(map_data.size() + presize_limit(r, map_size_read, sizeof(std::pair<K, V>)));
+    for(size_t i = 0; i<map_size_read && !r.failed();i++){
+        std::pair<K, V> p;
         r>>p;
-        ret = map_data.insert(p);
-        if(ret.second == false) {
-            //throw exception here
+        map_data.emplace(std::move(p));
+    }
+    if (r.failed())
+      map_data.clear();
+}
+
+/**
+ * Deserialize std::deque, growing it by up to presize_limit elements
+ * at a time and reading the elements in place. Elements are appended.
+*/
+template<typename Reader, typename T, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::deque<T, Alloc>& deque_data) {
+    size_t deque_size_read = read_length(r);
+    size_t end = deque_data.size() + deque_size_read;
+    while (deque_data.size() < end && !r.failed()) {
+        size_t i = deque_data.size();
+        deque_data.resize(i + presize_limit(r, end - i, sizeof(T)));
+        for(; i<deque_data.size();i++){
+            r>>deque_data[i];
         }
     }
+    if (r.failed())
+      deque_data.clear();
+}
+
+/**
+ * Deserialize std::list, reading each element into a new node at the
+ * end. Elements are appended.
+*/
+template<typename Reader, typename T, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::list<T, Alloc>& list_data) {
+    size_t list_size_read = read_length(r);
+    for(size_t i = 0; i<list_size_read && !r.failed();i++){
+        list_data.emplace_back();
+        r>>list_data.back();
+    }
+    if (r.failed())
+      list_data.clear();
+}
+
+/**
+ * Deserialize std::set. The elements were written in order, so
+ * inserting with the end() hint takes amortized constant time.
+*/
+template<typename Reader, typename T, typename Compare, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::set<T, Compare, Alloc>& set_data) {
+    size_t set_size_read = read_length(r);
+    for(size_t i = 0; i<set_size_read && !r.failed();i++){
+        T element;
+        r>>element;
+        set_data.emplace_hint(set_data.end(), std::move(element));
+    }
+    if (r.failed())
+      set_data.clear();
+}
+
+/**
+ * Deserialize std::unordered_set, sized for the elements first (up to
+ * presize_limit of them)
+*/
+template<typename Reader, typename T, typename Hash, typename Eq, typename Alloc>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::unordered_set<T, Hash, Eq, Alloc>& set_data) {
+    size_t set_size_read = read_length(r);
+    set_data.reserve(set_data.size() + presize_limit(r, set_size_read, sizeof(T)));
+    for(size_t i = 0; i<set_size_read && !r.failed();i++){
+        T element;
+        r>>element;
+        set_data.emplace(std::move(element));
+    }
+    if (r.failed())
+      set_data.clear();
+}
+
+/**
+ * Deserialize std::array
+ * @throw SizeMismatchException if the stored length is not N
+*/
+template<typename Reader, typename T, size_t N>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::array<T, N>& array_data) {
+    size_t array_size_read = read_length(r);
+    if (array_size_read != N)
+      r.report_error(read_size_mismatch, SizeMismatchException(array_size_read, N));
+    deserialize_elements(r, array_data.data(), N);
+}
+
+template<typename Reader, typename... Ts>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::tuple<Ts...>& tuple_data) {
+    tuple_elements<0, sizeof...(Ts)>::read(r, tuple_data);
+}
+
+/**
+ * Deserialize std::shared_ptr, sharing the object with every other
+ * shared_ptr to it read from the same stream
+*/
+template<typename Reader, typename T>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::shared_ptr<T>& pointer_data) {
+    read_pointer(r, &pointer_data, false);
+}
+
+/**
+ * Deserialize std::unique_ptr. The object is allocated with new, and
+ * given to the deleter the unique_ptr already has, which must free it
+ * as delete would.
+ * @throw InvalidDataException if the object has another owner
+*/
+template<typename Reader, typename T, typename Deleter>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::unique_ptr<T, Deleter>& pointer_data) {
+    pointer_data.reset(read_pointer(r, static_cast<std::shared_ptr<T>*>(nullptr), true));
+}
+
+#if __cplusplus >= 201703L
+template<typename Reader, typename T>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::optional<T>& optional_data) {
+    bool has_value = false;
+    r>>has_value;
+    if (has_value)
+      r>>optional_data.emplace();
+    if (!has_value || r.failed())
+      optional_data.reset();
+}
+
+/**
+ * Constructs alternative `index' of the variant and reads into it
+*/
+template<size_t I, typename Reader, typename... Ts>
+void deserialize_alternative(Reader& r, std::variant<Ts...>& variant_data, size_t index) {
+    if constexpr (I < sizeof...(Ts)) {
+      if (index == I) {
+        r>>variant_data.template emplace<I>();
+        return;
+      }
+      deserialize_alternative<I + 1>(r, variant_data, index);
+    }
 }
+
+/**
+ * Deserialize std::variant
+ * @throw InvalidDataException if the stored index is not that of an
+ * alternative
+*/
+template<typename Reader, typename... Ts>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize(Reader& r, std::variant<Ts...>& variant_data) {
+    variant_index index = 0;
+    r>>index;
+    if (index >= sizeof...(Ts)) {
+      r.report_error(read_invalid_data, InvalidDataException());
+      return;
+    }
+    deserialize_alternative<0>(r, variant_data, index);
+}
+#endif
 #endif
@@ -14,9 +14,20 @@
 
 #include "common.hpp"
 #include "types.hpp"
+#include "object_tracking.hpp"
+#include "profiler.hpp"
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 
+/**
+ * Most elements a container (or characters a string) makes room for
+ * at once from a count read from a stream, which may be corrupt: the
+ * rest are added as they are actually read.
+ */
+const size_t max_presize_elements = 65536;
+
 /** 
  * Base StreamReader abstract class. All user-implemented stream
  * readers must inherit from this.
@@ -44,7 +55,11 @@ public:
    *
    * @param is istream object
    */
-  StreamReader(istream& m_stream): stream(&m_stream)
+  StreamReader(istream& m_stream): stream(&m_stream), object_arena(nullptr),
+				      error_codes(false), first_error(read_ok)
+#ifdef SERIALIZE_PROFILE
+    , attached_profiler(nullptr)
+#endif
   {
   }
 
@@ -55,11 +70,220 @@ public:
    */
   virtual ~StreamReader() = 0;
 
+  /** 
+   * Read data written with object tracking (see
+   * StreamWriter::track_objects).
+   *
+   * @param enable whether the data was written with object tracking
+   */
+  void track_objects(bool enable = true)
+  {
+    objects_read.set_tracking(enable);
+  }
+
+  /** 
+   * @return the objects read through pointers so far
+   */
+  ReadObjects & read_objects()
+  {
+    return objects_read;
+  }
+
+  /** 
+   * Construct the objects read through pointers in `arena' instead of
+   * allocating each with new. They are then owned by the arena and
+   * freed all at once with it: raw pointers to them must not be
+   * deleted, and shared_ptrs to them do not delete them.
+   * (unique_ptrs still own objects allocated with new.)
+   *
+   * @param arena arena outliving the objects read, or nullptr
+   */
+  void use_arena(Arena* arena)
+  {
+    object_arena = arena;
+  }
+
+  /** 
+   * @return the arena objects are constructed in, or nullptr
+   */
+  Arena* arena() const
+  {
+    return object_arena;
+  }
+
+  /** 
+   * Record errors in the data instead of throwing them, eg. to decode
+   * packets which are often truncated. Only the first error is kept,
+   * in error(); after it nothing more is read from the input and
+   * values read give zeros, empty strings and containers, or null
+   * pointers, so a whole message can be read and error() checked
+   * once at the end. What was read around the error is not to be
+   * used. Errors in the use of the reader itself (eg. a view
+   * requested from a stream) still throw.
+   *
+   * @param enable whether to use error codes
+   */
+  void use_error_codes(bool enable = true)
+  {
+    error_codes = enable;
+  }
+
+  bool uses_error_codes() const
+  {
+    return error_codes;
+  }
+
+  /** 
+   * @return the first error recorded, or read_ok
+   */
+  ReadError error() const
+  {
+    return first_error;
+  }
+
+  bool failed() const
+  {
+    return first_error != read_ok;
+  }
+
+  /** 
+   * Forget the error recorded, eg. to read the next message from
+   * another buffer. (The stream state, if any, is the caller's.)
+   */
+  void clear_error()
+  {
+    first_error = read_ok;
+  }
+
+  /** 
+   * Report an error in the data: throw `exception', or with error
+   * codes record `code' if no error was recorded before and set the
+   * stream's failbit so that nothing more is read from it.
+   */
+  template <typename E>
+  void report_error(ReadError code, const E & exception)
+  {
+    if (!error_codes)
+      throw exception;
+    if (first_error == read_ok)
+      first_error = code;
+    if (stream)
+      stream->setstate(ios::failbit);
+  }
+
+  /** 
+   * A number of elements or bytes read as a uint64_t (see
+   * write_length), as a size_t.
+   *
+   * @return `length', or 0 if it does not fit in a size_t
+   * @throw InvalidDataException if it does not fit
+   */
+  size_t checked_length(uint64_t length)
+  {
+    if (static_cast<size_t>(length) != length)
+      {
+	report_error(read_invalid_data, InvalidDataException());
+	return 0;
+      }
+    return static_cast<size_t>(length);
+  }
+
+  /** 
+   * Position in the input stream, or 0 if the stream cannot tell
+   * (eg. a pipe). Readers which do not read from a stream define
+   * their own.
+   */
+  size_t position() const
+  {
+    if (!stream)
+      return 0;
+    std::streamoff pos = stream->rdbuf()->pubseekoff(0, ios::cur, ios::in);
+    return pos < 0 ? 0 : static_cast<size_t>(pos);
+  }
+
+#ifdef SERIALIZE_PROFILE
+  /** 
+   * Record every >> on this reader in `p' (see profiler.hpp).
+   *
+   * @param p profiler, or nullptr to stop profiling
+   */
+  void set_profiler(Profiler* p)
+  {
+    attached_profiler = p;
+  }
+
+  Profiler* profiler() const
+  {
+    return attached_profiler;
+  }
+#endif
+
 protected:
+  /** 
+   * After reading from the stream, report the end of the stream or a
+   * failed read, like checkandthrowBasicException.
+   *
+   * @return true if the stream is still good
+   */
+  bool check_stream()
+  {
+    if (stream->eof())
+      report_error(read_end_of_file, EndOfFileException());
+    else if (stream->fail())
+      report_error(read_fail, FailBitException());
+    else
+      return true;
+    return false;
+  }
+
+  /** 
+   * Read `len' characters from the stream into `string_data', making
+   * room for no more than max_presize_elements of them at a time as
+   * `len' may be corrupt. With error codes, the string is left empty
+   * if they are not all there.
+   */
+  template <typename String>
+  void read_characters(String & string_data, size_t len)
+  {
+    string_data.clear();
+    while (string_data.size() < len)
+      {
+	size_t done = string_data.size();
+	string_data.resize(done + std::min(len - done, max_presize_elements));
+	stream->read(&string_data[done], string_data.size() - done);
+	if (!check_stream())
+	  {
+	    string_data.clear();
+	    return;
+	  }
+      }
+  }
+
+  /** 
+   * For readers which do not read from an istream (eg. from a memory
+   * buffer). The stream member is left null.
+   */
+  StreamReader(): stream(nullptr), object_arena(nullptr),
+		  error_codes(false), first_error(read_ok)
+#ifdef SERIALIZE_PROFILE
+    , attached_profiler(nullptr)
+#endif
+  {
+  }
+
   /**
    * istream object from where data has to be read.
    */
   istream* stream;
+
+private:
+  ReadObjects objects_read;	/**< objects read through pointers */
+  Arena* object_arena;		/**< where to construct them, if not with new */
+  bool error_codes;		/**< record errors rather than throw them */
+  ReadError first_error;	/**< first error recorded, with error codes */
+#ifdef SERIALIZE_PROFILE
+  Profiler* attached_profiler;	/**< where to record each >>, if anywhere */
+#endif
 };
 
 /** 
@@ -81,29 +305,229 @@ template <typename Reader, typename T>
 typename std::enable_if<std::is_base_of<StreamReader, Reader>::value, Reader&>::type
 operator>>(Reader & reader, T & T_data)
 {
+  SERIALIZE_PROFILE_TYPE(reader, T);
   // For classes, `load' should rely on `deserialize' to read the members
   reader.load(T_data);
   deserialize(reader, T_data);
   return reader;
 }
 
+/** 
+ * Reads the stored type of a polymorphic object and returns the
+ * matching registered type. By default the type is stored as its key,
+ * a string. Readers whose writers encode types differently overload
+ * this.
+ *
+ * @param reader Object of a derived class of StreamReader
+ *
+ * @return Matching TiedInfoBase object for the type read
+ */
+template <typename Reader>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value,
+			TiedInfoBase<Reader>*>::type
+read_type_info(Reader & reader)
+{
+  std::string type_name_stored;
+  reader>>type_name_stored;
+
+  auto info = InfoList<Reader>::find_type_by_key(type_name_stored);
+  if (!info && !reader.failed())
+    reader.report_error(read_type_not_registered, TypeNotRegisteredException(type_name_stored));
+  return info;
+}
+
+/** 
+ * Number a newly constructed object, giving it to `owner' if not
+ * null, before its contents are read.
+ */
+template <typename Reader, typename T>
+void add_read_object(Reader & reader, void* object, std::shared_ptr<T>* owner, Arena* arena,
+		     bool unique)
+{
+  // objects in an arena are owned by it from the start, so nothing
+  // deletes them and no unique_ptr can take them over
+  std::shared_ptr<void> shared;
+  if (arena)
+    shared = std::shared_ptr<T>(static_cast<T*>(object), [](T*) { });
+  else if (owner)
+    shared = std::shared_ptr<T>(static_cast<T*>(object));
+  if (owner)
+    *owner = std::static_pointer_cast<T>(shared);
+  reader.read_objects().add(object, std::move(shared), unique);
+}
+
+/** 
+ * Construct and read an object pointed to, the counterpart of
+ * write_pointee: a polymorphic one as its stored type, others as T.
+ */
+template <typename Reader, typename T>
+typename std::enable_if<std::is_polymorphic<T>::value, T*>::type
+read_new_object(Reader & reader, std::shared_ptr<T>* owner, bool unique)
+{
+  Arena* arena = unique ? nullptr : reader.arena();
+  auto match_elem = read_type_info(reader);
+  if (!match_elem)
+    {
+      if (owner)
+	owner->reset();
+      return nullptr;
+    }
+  void* object = match_elem->construct(arena);
+  add_read_object(reader, object, owner, arena, unique);
+  match_elem->deserialize_into(reader, object);
+  return static_cast<T*>(object);
+}
+
+template <typename Reader, typename T>
+typename std::enable_if<!std::is_polymorphic<T>::value, T*>::type
+read_new_object(Reader & reader, std::shared_ptr<T>* owner, bool unique)
+{
+  Arena* arena = unique ? nullptr : reader.arena();
+  T* object = arena ? arena->create<T>() : new T;
+  add_read_object(reader, object, owner, arena, unique);
+  reader>>*object;
+  return object;
+}
+
+/** 
+ * Read a pointer written by write_pointer. An object pointed to more
+ * than once is only constructed once.
+ *
+ * @param reader Object of a derived class of StreamReader
+ * @param owner if not null, set to share ownership of the object
+ * @param unique whether the object is to be owned by a unique_ptr
+ *
+ * @return the object, or nullptr
+ * @throw InvalidDataException for an unknown reference number, or an
+ * object with conflicting owners
+ */
+template <typename Reader, typename T>
+T* read_pointer(Reader & reader, std::shared_ptr<T>* owner, bool unique)
+{
+  size_t reference = read_length(reader);
+  ReadObjects & objects = reader.read_objects();
+  bool is_new = reference == objects.next_reference();
+  if (reference == 0 || reader.failed()
+      || (!is_new && !objects.can_refer(reference, owner != nullptr, unique)))
+    {
+      if (reference != 0 && !reader.failed())
+	reader.report_error(read_invalid_data, InvalidDataException());
+      if (owner)
+	owner->reset();
+      return nullptr;
+    }
+
+  if (is_new)
+    return read_new_object(reader, owner, unique);
+  if (owner)
+    {
+      *owner = objects.template shared<T>(reference);
+      return owner->get();
+    }
+  if (unique)
+    return static_cast<T*>(objects.take_unique(reference));
+  return static_cast<T*>(objects.address(reference));
+}
+
+/** 
+ * Read a pointer to a polymorphic object, constructing an object of
+ * the type stored. With object tracking, an object pointed to several
+ * times is constructed once.
+ */
 template <typename Reader, typename T>
 typename std::enable_if<std::is_base_of<StreamReader, Reader>::value
 && std::is_polymorphic<T>::value, Reader&>::type
   operator>>(Reader & reader, T* & T_data)
 {
+  SERIALIZE_PROFILE_TYPE(reader, T*);
+  if (reader.read_objects().is_tracking())
+    {
+      T_data = read_pointer(reader, static_cast<std::shared_ptr<T>*>(nullptr), false);
+      return reader;
+    }
+
   // T is of pointer type. Assume polymorphic
-  std::string type_name_stored;
-  reader>>type_name_stored;
 
   // Matching Info object corresponding to the dynamic type
-  auto match_elem = InfoList<Reader>::get_matching_type_by_key(type_name_stored);
+  auto match_elem = read_type_info(reader);
   // call_deserialize returns void*, so cast to T* and return
-  T_data = static_cast<T*>(match_elem->call_deserialize(reader));
+  T_data = match_elem ? static_cast<T*>(match_elem->call_deserialize(reader)) : nullptr;
 
   return reader;
 }
 
+/** 
+ * Deserialize `count' contiguous elements into the storage starting
+ * at `data', one at a time using the >> operator.
+ *
+ * Readers which can read some element types as a single block
+ * (eg. BinaryStreamReader for arithmetic types) overload this.
+ *
+ * @param reader Object of a derived class of StreamReader
+ * @param data pointer to the first element to read into
+ * @param count number of elements
+ */
+template <typename Reader, typename T>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize_elements(Reader & reader, T* data, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    reader>>data[i];
+}
+
+/** 
+ * Read a number of elements or bytes written by write_length.
+ *
+ * @param reader Object of a derived class of StreamReader
+ *
+ * @return the number read, or 0 with error codes if it is too large
+ * for a size_t
+ * @throw InvalidDataException if it is too large for a size_t
+ */
+template <typename Reader>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value, size_t>::type
+read_length(Reader & reader)
+{
+  uint64_t length = 0;
+  reader>>length;
+  return reader.checked_length(length);
+}
+
+/** 
+ * How many of `count' elements, as stored before the elements, a
+ * container may make room for in one go. Readers which know how much
+ * input is left (eg. BinaryStreamReader reading from memory) overload
+ * this to allow no more than that could hold.
+ *
+ * @param reader Object of a derived class of StreamReader
+ * @param count number of elements still to read
+ * @param element_size bytes each element takes at least in the input
+ *
+ * @return between 1 and `count' (0 if `count' is 0)
+ */
+template <typename Reader>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value, size_t>::type
+presize_limit(Reader &, size_t count, size_t)
+{
+  return std::min(count, max_presize_elements);
+}
+
+/** 
+ * Deserialize into the given members of `object', in order, using the
+ * >> operator. The counterpart of serialize_members.
+ *
+ * @param reader Object of a derived class of StreamReader
+ * @param object object whose members are read
+ * @param members pointers to the members to read
+ */
+template <typename Reader, typename C, typename... Members>
+typename std::enable_if<std::is_base_of<StreamReader, Reader>::value>::type
+deserialize_members(Reader & reader, C & object, Members... members)
+{
+  int in_order[] = {0, ((void)(reader>>(object.*members)), 0)...};
+  (void)in_order;
+}
+
 /** 
  * Default implementation which should do nothing. The user must
  * define specialized functions for their classes, which will
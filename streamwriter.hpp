@@ -14,7 +14,10 @@
 
 #include "common.hpp"
 #include "types.hpp"
+#include "object_tracking.hpp"
+#include "profiler.hpp"
 
+#include <cstdint>
 #include <iostream>
 
 /**
@@ -43,6 +46,9 @@ public:
    * @param m_stream ostream object, must be open.
    */  
   StreamWriter(ostream& m_stream): stream(&m_stream)
+#ifdef SERIALIZE_PROFILE
+    , attached_profiler(nullptr)
+#endif
   {
   }
 
@@ -50,9 +56,78 @@ public:
    * Pure virtual destructor to make this an abstract class.
    */
   virtual ~StreamWriter() = 0;		// don't close stream here
+
+  /** 
+   * Write every object reached through a pointer only once: later
+   * pointers to it are written as a reference to the first. Pointers
+   * to polymorphic objects are then preceded by a reference number
+   * (see object_tracking.hpp), so the reader must track objects too.
+   * std::shared_ptr and std::unique_ptr always carry one.
+   *
+   * @param enable whether to track objects
+   */
+  void track_objects(bool enable = true)
+  {
+    objects_written.set_tracking(enable);
+  }
+
+  /** 
+   * @return the objects written through pointers so far
+   */
+  WrittenObjects & written_objects()
+  {
+    return objects_written;
+  }
+
+  /** 
+   * Position in the output stream, or 0 if the stream cannot tell
+   * (eg. a pipe). Writers which buffer or do not write to a stream
+   * define their own, so that profiling sees every byte.
+   */
+  size_t position() const
+  {
+    if (!stream)
+      return 0;
+    std::streamoff pos = stream->rdbuf()->pubseekoff(0, ios::cur, ios::out);
+    return pos < 0 ? 0 : static_cast<size_t>(pos);
+  }
+
+#ifdef SERIALIZE_PROFILE
+  /** 
+   * Record every << on this writer in `p' (see profiler.hpp).
+   *
+   * @param p profiler, or nullptr to stop profiling
+   */
+  void set_profiler(Profiler* p)
+  {
+    attached_profiler = p;
+  }
+
+  Profiler* profiler() const
+  {
+    return attached_profiler;
+  }
+#endif
   
 protected:
+  /** 
+   * For writers which do not write to an ostream (eg. into a memory
+   * buffer). The stream member is left null.
+   */
+  StreamWriter(): stream(nullptr)
+#ifdef SERIALIZE_PROFILE
+    , attached_profiler(nullptr)
+#endif
+  {
+  }
+
   ostream* stream;		/**< stream to write to */
+
+private:
+  WrittenObjects objects_written; /**< objects written through pointers */
+#ifdef SERIALIZE_PROFILE
+  Profiler* attached_profiler;	/**< where to record each <<, if anywhere */
+#endif
 };
 
 StreamWriter::~StreamWriter()
@@ -77,16 +152,59 @@ template <typename Writer, typename T>
 typename std::enable_if <std::is_base_of<StreamWriter, Writer>::value, Writer&>::type
 operator<<(Writer & writer, const T & T_data)
 {
+  SERIALIZE_PROFILE_TYPE(writer, T);
   // For classes, `save' should rely on `serialize' to write the members
   writer.save(T_data);
   serialize(writer, T_data);
   return writer;
 }
 
+/** 
+ * Serialize the object pointed to: a polymorphic one through its
+ * registered type, others directly.
+ */
+template <typename Writer, typename T>
+typename std::enable_if<std::is_polymorphic<T>::value>::type
+write_pointee(Writer & writer, T* T_data)
+{
+  auto match_elem = InfoList<Writer>::get_matching_type(T_data);
+  match_elem->call_serialize(writer, const_cast<void*>(static_cast<const void*>(T_data)));
+}
+
+template <typename Writer, typename T>
+typename std::enable_if<!std::is_polymorphic<T>::value>::type
+write_pointee(Writer & writer, T* T_data)
+{
+  writer<<*T_data;
+}
+
+/** 
+ * Write a pointer as its reference number, followed by the object
+ * pointed to if it has not been written before (see
+ * object_tracking.hpp). Null pointers are allowed.
+ *
+ * @param writer Derived StreamWriter instance
+ * @param T_data pointer to write
+ */
+template <typename Writer, typename T>
+void write_pointer(Writer & writer, T* T_data)
+{
+  size_t reference = 0;
+  bool is_new = false;
+  if (T_data)
+    reference = writer.written_objects().reference(object_address(T_data),
+						   object_type(T_data), is_new);
+  write_length(writer, reference);
+  if (is_new)
+    write_pointee(writer, T_data);
+}
+
 /** 
  * If the object to be serialized is of (Polymorphic *) type, get the
  * actual (derived) type of the object and serialize it.
  *
+ * With object tracking, it is only written the first time.
+ *
  * @param writer Derived StreamWriter instance
  * @param T_data Pointer to polymorphic type whose contents are to be serialized
  *
@@ -97,6 +215,13 @@ typename std::enable_if <std::is_base_of<StreamWriter, Writer>::value
 && std::is_polymorphic<T>::value, Writer&>::type
 operator<<(Writer & writer, T* T_data)
 {
+  SERIALIZE_PROFILE_TYPE(writer, T*);
+  if (writer.written_objects().is_tracking())
+    {
+      write_pointer(writer, T_data);
+      return writer;
+    }
+
   // T is of pointer type. Assume polymorphic
   auto match_elem = InfoList<Writer>::get_matching_type(T_data);
   match_elem->call_serialize(writer, T_data);
@@ -104,6 +229,60 @@ operator<<(Writer & writer, T* T_data)
   return writer;
 }
 
+/** 
+ * Serialize `count' contiguous elements starting at `data', one at a
+ * time using the << operator. Used for arrays and vectors.
+ *
+ * Writers which can write some element types as a single block
+ * (eg. BinaryStreamWriter for arithmetic types) overload this.
+ *
+ * @param writer Derived StreamWriter instance
+ * @param data pointer to the first element
+ * @param count number of elements
+ */
+template <typename Writer, typename T>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize_elements(Writer & writer, const T* data, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    writer<<data[i];
+}
+
+/** 
+ * Write a number of elements or bytes, eg. the size of a container.
+ * It is always written as a uint64_t, so that it takes the same room
+ * whatever the width of size_t on the writing host (binary_portable).
+ *
+ * @param writer Derived StreamWriter instance
+ * @param length number to write
+ */
+template <typename Writer>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+write_length(Writer & writer, size_t length)
+{
+  writer<<static_cast<uint64_t>(length);
+}
+
+/** 
+ * Serialize the given members of `object', in order, using the <<
+ * operator. Called by the `serialize' functions generated by
+ * SERIALIZE_MEMBERS (see members.hpp).
+ *
+ * Writers which can write runs of adjacent members as a single block
+ * (eg. BinaryStreamWriter) overload this.
+ *
+ * @param writer Derived StreamWriter instance
+ * @param object object whose members are written
+ * @param members pointers to the members to write
+ */
+template <typename Writer, typename C, typename... Members>
+typename std::enable_if<std::is_base_of<StreamWriter, Writer>::value>::type
+serialize_members(Writer & writer, const C & object, Members... members)
+{
+  int in_order[] = {0, ((void)(writer<<(object.*members)), 0)...};
+  (void)in_order;
+}
+
 /** 
  * Default implementation of `serialize'.
  *
@@ -1,13 +1,30 @@
 #include "binary_streamreader.hpp"
 #include "binary_streamwriter.hpp"
+#include "mapped_file.hpp"
+#include "size_writer.hpp"
+#include "members.hpp"
+#include "arena.hpp"
+#include "columns.hpp"
+#include "chunks.hpp"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <typeinfo>
 #include <vector>
 #include <utility>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
+#include <deque>
+#include <list>
+#include <array>
+#include <tuple>
+#include <memory>
 #include <algorithm>
+#include <cstring>
+#include <thread>
 #define _GLIBCXX_DEBUG
 
 using namespace std;
@@ -135,6 +152,103 @@ void deserialize(Reader & r, Derived<T> & d)
     r>>d.x;
 }
 
+// fixed size: written and read in one step
+struct point
+{
+    int x;
+    short y;
+    double w[3];
+};
+
+template <>
+struct fixed_binary_size<point>: fixed_binary_size_of<int, short, double[3]> { };
+
+template <class Writer>
+void serialize(Writer & w, const point & p)
+{
+    w<<p.x<<p.y<<p.w;
+}
+
+template <class Reader>
+void deserialize(Reader & r, point & p)
+{
+    r>>p.x>>p.y>>p.w;
+}
+
+bool operator==(const point & a, const point & b)
+{
+    return a.x == b.x && a.y == b.y && equal(a.w, a.w + 3, b.w);
+}
+
+// serialize/deserialize generated from the member list
+class record
+{
+    int id;
+    short kind;
+    short flags;
+    double weight;
+    string name;
+    long stamps[2];
+    char grade;
+public:
+    record(): id(0), kind(0), flags(0), weight(0), stamps{}, grade(0) { }
+    record(int i, string n): id(i), kind(short(i % 3)), flags(-1), weight(i * 1.5),
+                             name(n), stamps{i * 100L, -i * 100L}, grade(char('A' + i % 5)) { }
+    bool operator==(const record & r) const
+    {
+        return id == r.id && kind == r.kind && flags == r.flags && weight == r.weight && name == r.name
+            && stamps[0] == r.stamps[0] && stamps[1] == r.stamps[1] && grade == r.grade;
+    }
+    template <class Writer>
+    void serialize_by_member(Writer & w) const
+    {
+        w<<id<<kind<<flags<<weight<<name<<stamps<<grade;
+    }
+
+    SERIALIZE_MEMBERS(record, id, kind, flags, weight, name, stamps, grade)
+};
+
+struct reading
+{
+    double value;
+    int count;
+    SERIALIZE_MEMBERS(reading, value, count)
+};
+
+// linked through shared pointers, possibly in a cycle
+struct graph_node
+{
+    int value;
+    shared_ptr<graph_node> next;
+    SERIALIZE_MEMBERS(graph_node, value, next)
+};
+
+// a unique_ptr deleter with state, which reading must keep
+struct counting_delete
+{
+    int* count;
+    void operator()(graph_node* node) const
+    {
+        ++*count;
+        delete node;
+    }
+};
+
+// declares a size which does not match what it writes
+struct misdeclared
+{
+    int x;
+};
+
+template <>
+struct fixed_binary_size<misdeclared>: fixed_binary_size_of<int, int> { };
+
+template <class Writer>
+void serialize(Writer & w, const misdeclared & m)
+{
+    w<<m.x;
+}
+
 int main()
 {
     char char_data = 'C';
@@ -160,6 +274,11 @@ int main()
     Base* b1 = new Derived<float> {42.51};
     Base* b2 = new Derived<string> {"hello!"};
     int matrix[][3] = {{1,2,100}, {3,4,101}, {5,6,102}};
+    vector<double> v_double(1000);
+    for (size_t i = 0; i < v_double.size(); ++i)
+        v_double[i] = i * 0.25;
+    vector<bool> v_bool = {true, false, true};
+    vector<string> v_string = {"first", "", "third\nwith a newline"};
     ofstream os("out.txt", ios::out|ios::binary|ios::trunc);
     os.seekp(ios::beg);
     BinaryStreamWriter writer(os);
@@ -172,6 +291,7 @@ int main()
     writer<<b1;
     writer<<b2;
     writer<<matrix;
+    writer<<v_double<<v_bool<<v_string;
     os.close();
 
     char char_read;
@@ -189,6 +309,9 @@ int main()
     Base* br1;
     Base* br2;
     int read_matrix[3][3] = {};
+    vector<double> v_double_read;
+    vector<bool> v_bool_read;
+    vector<string> v_string_read;
     ifstream is("out.txt", ios::in|ios::binary);
     BinaryStreamReader reader(is);
 
@@ -200,6 +323,7 @@ int main()
     reader>>br1;
     reader>>br2;
     reader>>read_matrix;
+    reader>>v_double_read>>v_bool_read>>v_string_read;
     is.close();
 
     if (char_read != char_data)
@@ -217,6 +341,16 @@ int main()
     }
     if(v_read != v)
         cout<<"Read vector: "<<v_read[0]<<" | Expected vector: "<<v[0]<<endl;
+    if(v_double_read != v_double)
+        cout<<"Read double vector of size: "<<v_double_read.size()<<" | Expected size: "<<v_double.size()<<endl;
+    if(v_bool_read != v_bool)
+        cout<<"Read bool vector of size: "<<v_bool_read.size()<<" | Expected size: "<<v_bool.size()<<endl;
+    if(v_string_read != v_string)
+        cout<<"Read string vector of size: "<<v_string_read.size()<<" | Expected size: "<<v_string.size()<<endl;
+    for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+            if(read_matrix[i][j] != matrix[i][j])
+                cout<<"Read matrix element: "<<read_matrix[i][j]<<" | Expected element: "<<matrix[i][j]<<endl;
     if(b_data != b_read)
         cout<<"Read bool: "<<b_read<<" | Expected bool: "<<b_data<<endl;
     if(p_read != p_data)
@@ -227,5 +361,730 @@ int main()
         cout<<"Read class: "<<d_cls_read.string_mem<<", "<<d_cls_read.int_mem<<endl;
     if(m.size() != m_read.size() || !(equal(m.begin(), m.end(), m_read.begin())))
             cout<<"Read map "<<"tomatoes "<<m_read["tomatoes"]<<"saf\ndfew "<<m_read["saf\ndfew"]<<endl;
+
+    // buffered and in-memory writers must produce the same bytes
+    ostringstream unbuffered_os, buffered_os;
+    vector<char> memory_out;
+    {
+        BinaryStreamWriter unbuffered_writer(unbuffered_os);
+        BinaryStreamWriter buffered_writer(buffered_os, 16);
+        BinaryStreamWriter memory_writer(memory_out);
+        unbuffered_writer<<char_data<<string_data<<int_array<<cls<<v_double<<m<<b2;
+        buffered_writer<<char_data<<string_data<<int_array<<cls<<v_double<<m<<b2;
+        memory_writer<<char_data<<string_data<<int_array<<cls<<v_double<<m<<b2;
+    }
+    string memory_bytes(memory_out.begin(), memory_out.end());
+    if(buffered_os.str() != unbuffered_os.str())
+        cout<<"Buffered writer output differs from unbuffered writer output"<<endl;
+    if(memory_bytes != unbuffered_os.str())
+        cout<<"Memory writer output differs from unbuffered writer output"<<endl;
+
+    // read back straight from memory
+    BinaryStreamReader memory_reader(memory_out.data(), memory_out.size());
+    char mem_char_read;
+    string mem_string_read;
+    int mem_int_array_read[10];
+    myclass mem_cls_read;
+    vector<double> mem_v_double_read;
+    map<string, int> mem_m_read;
+    Base* mem_br2;
+    memory_reader>>mem_char_read>>mem_string_read>>mem_int_array_read>>mem_cls_read>>mem_v_double_read>>mem_m_read>>mem_br2;
+    if(mem_char_read != char_data || mem_string_read != string_data || mem_v_double_read != v_double || mem_m_read != m)
+        cout<<"Read from memory does not match written data"<<endl;
+    if(!equal(int_array, int_array + 10, mem_int_array_read))
+        cout<<"Read int array from memory does not match"<<endl;
+    if(mem_cls_read.int_mem != cls.int_mem || mem_cls_read.string_mem != cls.string_mem)
+        cout<<"Read class from memory: "<<mem_cls_read.string_mem<<", "<<mem_cls_read.int_mem<<endl;
+    if(static_cast<Derived<string>*>(mem_br2)->x != "hello!")
+        cout<<"Read polymorphic from memory: "<<static_cast<Derived<string>*>(mem_br2)->x<<endl;
+    if(memory_reader.bytes_remaining() != 0)
+        cout<<"Bytes left after reading from memory: "<<memory_reader.bytes_remaining()<<endl;
+
+    // truncated input must throw rather than read past the end
+    BinaryStreamReader truncated_reader(memory_out.data(), 3);
+    try
+    {
+        truncated_reader>>mem_char_read>>mem_string_read;
+        cout<<"Reading truncated data did not throw"<<endl;
+    }
+    catch(EndOfFileException&)
+    {
+    }
+
+    // a corrupt element count must not be allocated for up front
+    vector<char> huge_out;
+    {
+        BinaryStreamWriter huge_writer(huge_out);
+        huge_writer<<(size_t(1) << 40)<<int_data;
+    }
+    try
+    {
+        BinaryStreamReader huge_reader(huge_out.data(), huge_out.size());
+        vector<int> huge_read;
+        huge_reader>>huge_read;
+        cout<<"Reading a corrupt vector size did not throw"<<endl;
+    }
+    catch(EndOfFileException&)
+    {
+    }
+    try
+    {
+        istringstream huge_is(string(huge_out.begin(), huge_out.end()));
+        BinaryStreamReader huge_reader(huge_is);
+        deque<string> huge_read;
+        huge_reader>>huge_read;
+        cout<<"Reading a corrupt deque size did not throw"<<endl;
+    }
+    catch(EndOfFileException&)
+    {
+    }
+
+    // with error codes it reads zeros instead, and keeps the first error
+    BinaryStreamReader coded_reader(memory_out.data(), 3);
+    coded_reader.use_error_codes();
+    char coded_char_read = 0;
+    string coded_string_read = "not read";
+    vector<double> coded_v_double_read;
+    int coded_int_read = 1;
+    coded_reader>>coded_char_read>>coded_string_read>>coded_v_double_read>>coded_int_read;
+    if(coded_reader.error() != read_end_of_file || coded_char_read != char_data
+       || !coded_string_read.empty() || !coded_v_double_read.empty() || coded_int_read != 0)
+        cout<<"Reading truncated data with error codes: "<<read_error_message(coded_reader.error())<<endl;
+    coded_reader.clear_error();
+    if(coded_reader.failed())
+        cout<<"Error not cleared"<<endl;
+
+    // nor with error codes, which leave the container or string empty
+    istringstream huge_in(string(huge_out.begin(), huge_out.end()));
+    BinaryStreamReader huge_coded_reader(huge_in);
+    huge_coded_reader.use_error_codes();
+    vector<int> huge_coded_read = {1, 2};
+    huge_coded_reader>>huge_coded_read;
+    if(huge_coded_reader.error() != read_end_of_file || !huge_coded_read.empty())
+        cout<<"Reading a corrupt vector size with error codes: "<<read_error_message(huge_coded_reader.error())<<endl;
+    istringstream huge_string_in(string(huge_out.begin(), huge_out.end()));
+    BinaryStreamReader huge_string_reader(huge_string_in);
+    huge_string_reader.use_error_codes();
+    string huge_string_read = "not read";
+    huge_string_reader>>huge_string_read;
+    if(huge_string_reader.error() != read_end_of_file || !huge_string_read.empty())
+        cout<<"Reading a corrupt string size with error codes: "<<read_error_message(huge_string_reader.error())<<endl;
+
+    vector<char> unknown_out;
+    {
+        BinaryStreamWriter unknown_writer(unknown_out);
+        unknown_writer<<string("no such type")<<int_data;
+    }
+    BinaryStreamReader unknown_reader(unknown_out.data(), unknown_out.size());
+    unknown_reader.use_error_codes();
+    Base* unknown_read = b1;
+    unknown_reader>>unknown_read;
+    if(unknown_read != nullptr || unknown_reader.error() != read_type_not_registered)
+        cout<<"Reading an unregistered type with error codes: "<<read_error_message(unknown_reader.error())<<endl;
+    try
+    {
+        BinaryStreamReader unknown_throwing_reader(unknown_out.data(), unknown_out.size());
+        unknown_throwing_reader>>unknown_read;
+        cout<<"Reading an unregistered type did not throw"<<endl;
+    }
+    catch(TypeNotRegisteredException& e)
+    {
+        if(string(e.what()).find("no such type") == string::npos)
+            cout<<"TypeNotRegisteredException: "<<e.what()<<endl;
+    }
+    if(string(SizeMismatchException(3, 10).what()).find("(3), and given length is (10)") == string::npos)
+        cout<<"SizeMismatchException: "<<SizeMismatchException(3, 10).what()<<endl;
+
+    // type keys written once, then as ids
+    vector<char> ids_out, keys_out;
+    {
+        BinaryStreamWriter ids_writer(ids_out, binary_type_ids);
+        BinaryStreamWriter keys_writer(keys_out);
+        ids_writer<<b1<<b2<<b1<<b1<<b2;
+        keys_writer<<b1<<b2<<b1<<b1<<b2;
+    }
+    if(ids_out.size() >= keys_out.size())
+        cout<<"Type ids did not shrink output: "<<ids_out.size()<<" bytes | Type keys: "<<keys_out.size()<<" bytes"<<endl;
+    BinaryStreamReader ids_reader(ids_out.data(), ids_out.size(), binary_type_ids);
+    Base* ids_read[5];
+    for(int i=0; i<5; i++)
+        ids_reader>>ids_read[i];
+    if(static_cast<Derived<float>*>(ids_read[3])->x != static_cast<Derived<float>*>(b1)->x
+       || static_cast<Derived<string>*>(ids_read[4])->x != "hello!")
+        cout<<"Read polymorphics with type ids do not match"<<endl;
+
+    // varint encoding of integers and sizes
+    vector<long> v_long = {0, -1, 1, -64, 64, 1L << 40, -(1L << 40)};
+    short short_data = -300;
+    unsigned long long ull_data = ~0ULL;
+    vector<char> varint_out, fixed_out;
+    {
+        BinaryStreamWriter varint_writer(varint_out, binary_varint);
+        BinaryStreamWriter fixed_writer(fixed_out);
+        varint_writer<<int_array<<v_long<<short_data<<ull_data<<string_data<<m<<v_double;
+        fixed_writer<<int_array<<v_long<<short_data<<ull_data<<string_data<<m<<v_double;
+    }
+    if(varint_out.size() >= fixed_out.size())
+        cout<<"Varints did not shrink output: "<<varint_out.size()<<" bytes | Fixed: "<<fixed_out.size()<<" bytes"<<endl;
+    BinaryStreamReader varint_reader(varint_out.data(), varint_out.size(), binary_varint);
+    int varint_int_array_read[10];
+    vector<long> v_long_read;
+    short short_read;
+    unsigned long long ull_read;
+    string varint_string_read;
+    map<string, int> varint_m_read;
+    vector<double> varint_v_double_read;
+    varint_reader>>varint_int_array_read>>v_long_read>>short_read>>ull_read>>varint_string_read>>varint_m_read>>varint_v_double_read;
+    if(!equal(int_array, int_array + 10, varint_int_array_read) || v_long_read != v_long
+       || short_read != short_data || ull_read != ull_data || varint_string_read != string_data
+       || varint_m_read != m || varint_v_double_read != v_double)
+        cout<<"Read varint data does not match written data"<<endl;
+    try
+    {
+        // read the unsigned long long into an int, which is too small
+        BinaryStreamReader overflow_reader(varint_out.data(), varint_out.size(), binary_varint);
+        vector<long> v_long_skipped;
+        int too_small;
+        overflow_reader>>varint_int_array_read>>v_long_skipped>>short_read>>too_small;
+        cout<<"Reading an out of range varint did not throw"<<endl;
+    }
+    catch(InvalidDataException&)
+    {
+    }
+    // the 10th byte of a varint has room for bit 63 only
+    const char too_wide[] = {'\xff', '\xff', '\xff', '\xff', '\xff', '\xff', '\xff', '\xff', '\xff', '\x02'};
+    BinaryStreamReader too_wide_reader(too_wide, sizeof(too_wide), binary_varint);
+    too_wide_reader.use_error_codes();
+    unsigned long long too_wide_read = 1;
+    too_wide_reader>>too_wide_read;
+    if(too_wide_reader.error() != read_invalid_data || too_wide_read != 0)
+        cout<<"Reading a varint wider than 64 bits: "<<read_error_message(too_wide_reader.error())<<endl;
+
+    // portable format: fixed width little-endian
+    vector<long double> v_long_double = {1.5L, -2.25L, 1e10L};
+    vector<char> portable_out;
+    {
+        BinaryStreamWriter portable_writer(portable_out, binary_portable);
+        portable_writer<<int_array<<v_long<<v_long_double<<v_double<<string_data<<m<<b1;
+    }
+    BinaryStreamReader portable_reader(portable_out.data(), portable_out.size(), binary_portable);
+    int portable_int_array_read[10];
+    vector<long> portable_v_long_read;
+    vector<long double> portable_v_long_double_read;
+    vector<double> portable_v_double_read;
+    string portable_string_read;
+    map<string, int> portable_m_read;
+    Base* portable_b1_read;
+    portable_reader>>portable_int_array_read>>portable_v_long_read>>portable_v_long_double_read>>portable_v_double_read;
+    portable_reader>>portable_string_read>>portable_m_read>>portable_b1_read;
+    if(!equal(int_array, int_array + 10, portable_int_array_read) || portable_v_long_read != v_long
+       || portable_v_long_double_read != v_long_double || portable_v_double_read != v_double
+       || portable_string_read != string_data || portable_m_read != m
+       || static_cast<Derived<float>*>(portable_b1_read)->x != static_cast<Derived<float>*>(b1)->x)
+        cout<<"Read portable data does not match written data"<<endl;
+    // 8-byte size, then little-endian ints
+    if(portable_out.size() < 12 || portable_out[0] != 10 || portable_out[8] != 1 || portable_out[11] != 0)
+        cout<<"Portable data is not little-endian with 64-bit sizes"<<endl;
+    uint32_t swapped[2] = {0x01020304u, 0xa0b0c0d0u};
+    byteswap_elements(swapped, 2);
+    if(swapped[0] != 0x04030201u || swapped[1] != 0xd0c0b0a0u)
+        cout<<"Byte swap: "<<hex<<swapped[0]<<" "<<swapped[1]<<dec<<endl;
+
+    // the size pre-pass must count exactly the bytes written
+    const BinaryFormat formats[] = {binary_native, binary_type_ids | binary_varint, binary_portable};
+    for(BinaryFormat format : formats)
+    {
+        vector<char> sized_out;
+        SizeWriter sizer(format);
+        REGISTER_TYPE(sizer, Derived<float>);
+        REGISTER_TYPE(sizer, Derived<string>);
+        sizer<<char_data<<string_data<<int_array<<str_array<<d_cls<<v_long<<v_bool<<m<<matrix<<b1<<b2<<b1;
+        {
+            BinaryStreamWriter sized_writer(sized_out, format);
+            sized_writer<<char_data<<string_data<<int_array<<str_array<<d_cls<<v_long<<v_bool<<m<<matrix<<b1<<b2<<b1;
+        }
+        if(sizer.size() != sized_out.size())
+            cout<<"Size pre-pass counted "<<sizer.size()<<" bytes | Written: "<<sized_out.size()<<" bytes"<<endl;
+    }
+
+    // fixed-size objects must be written exactly as member by member
+    static_assert(fixed_binary_size<point>::value == 4 + 2 + sizeof(uint64_t) + 3 * 8, "fixed size of point");
+    static_assert(fixed_binary_size<int[2][3]>::value == sizeof(uint64_t) + 2 * (sizeof(uint64_t) + 3 * 4), "fixed size of int[2][3]");
+    static_assert(fixed_binary_size<string>::value == 0 && fixed_binary_size_of<int, string>::value == 0, "string is not fixed size");
+    vector<point> points;
+    for(int i=0; i<100; i++)
+        points.push_back(point{i, short(-i), {i * 0.5, 1.0 / (i + 1), -1.0 * i}});
+    ostringstream points_os, points_buffered_os, points_by_member_os;
+    vector<char> points_out;
+    {
+        BinaryStreamWriter points_writer(points_os);
+        BinaryStreamWriter points_buffered_writer(points_buffered_os, 100);
+        BinaryStreamWriter points_memory_writer(points_out);
+        BinaryStreamWriter points_by_member_writer(points_by_member_os);
+        points_writer<<points<<int_data;
+        points_buffered_writer<<points<<int_data;
+        points_memory_writer<<points<<int_data;
+        points_by_member_writer<<points.size();
+        for(const point & p : points)
+            points_by_member_writer<<p.x<<p.y<<p.w;
+        points_by_member_writer<<int_data;
+    }
+    if(points_os.str() != points_by_member_os.str() || points_buffered_os.str() != points_by_member_os.str()
+       || string(points_out.begin(), points_out.end()) != points_by_member_os.str())
+        cout<<"Fixed-size objects not written as member by member"<<endl;
+    SizeWriter points_sizer;
+    points_sizer<<points<<int_data;
+    if(points_sizer.size() != points_out.size())
+        cout<<"Size pre-pass counted "<<points_sizer.size()<<" bytes for points | Written: "<<points_out.size()<<" bytes"<<endl;
+    BinaryStreamReader points_reader(points_out.data(), points_out.size());
+    istringstream points_is(points_os.str());
+    BinaryStreamReader points_stream_reader(points_is);
+    vector<point> points_read, points_stream_read;
+    points_reader>>points_read>>int_read;
+    points_stream_reader>>points_stream_read;
+    if(points_read != points || points_stream_read != points || int_read != int_data)
+        cout<<"Read fixed-size objects do not match"<<endl;
+    try
+    {
+        vector<char> misdeclared_out;
+        BinaryStreamWriter misdeclared_writer(misdeclared_out);
+        misdeclared_writer<<misdeclared{1};
+        cout<<"Misdeclared fixed size was not detected"<<endl;
+    }
+    catch(SizeMismatchException&)
+    {
+    }
+
+    // members listed with SERIALIZE_MEMBERS, written in runs
+    static_assert(fixed_binary_size<record>::value == 0, "record is not fixed size");
+    static_assert(fixed_binary_size<reading>::value == 12, "fixed size of reading");
+    vector<record> records;
+    for(int i=0; i<20; i++)
+        records.push_back(record(i, string(i, 'x')));
+    reading reading_data = {2.5, 7};
+    for(BinaryFormat format : formats)
+    {
+        vector<char> records_out, records_by_member_out;
+        {
+            BinaryStreamWriter records_writer(records_out, format);
+            BinaryStreamWriter records_by_member_writer(records_by_member_out, format);
+            records_writer<<records<<reading_data;
+            records_by_member_writer<<records.size();
+            for(const record & r : records)
+                r.serialize_by_member(records_by_member_writer);
+            records_by_member_writer<<reading_data.value<<reading_data.count;
+        }
+        if(records_out != records_by_member_out)
+            cout<<"Members not written as member by member"<<endl;
+        BinaryStreamReader records_reader(records_out.data(), records_out.size(), format);
+        vector<record> records_read;
+        reading reading_read;
+        records_reader>>records_read>>reading_read;
+        if(records_read != records || reading_read.value != reading_data.value || reading_read.count != reading_data.count)
+            cout<<"Read members do not match"<<endl;
+    }
+
+    // the same records column by column
+    for(BinaryFormat format : formats)
+    {
+        vector<char> columns_out;
+        SizeWriter columns_sizer(format);
+        {
+            BinaryStreamWriter columns_writer(columns_out, format);
+            columns_writer<<as_columns(records)<<reading_data;
+            columns_sizer<<as_columns(records)<<reading_data;
+        }
+        if(columns_sizer.size() != columns_out.size())
+            cout<<"Counted columns size: "<<columns_sizer.size()<<" | Written: "<<columns_out.size()<<endl;
+        if(format == binary_native)
+        {
+            int ids[20];
+            memcpy(ids, columns_out.data() + sizeof(uint64_t), sizeof(ids));
+            for(int i=0; i<20; i++)
+                if(ids[i] != i)
+                    cout<<"Column of ids not contiguous at: "<<i<<endl;
+        }
+        BinaryStreamReader columns_reader(columns_out.data(), columns_out.size(), format);
+        vector<record> columns_read(1, record(99, "kept"));
+        reading reading_read;
+        columns_reader>>as_columns(columns_read)>>reading_read;
+        if(columns_read.size() != 21 || !(columns_read[0] == record(99, "kept"))
+           || !equal(records.begin(), records.end(), columns_read.begin() + 1)
+           || reading_read.count != reading_data.count || columns_reader.bytes_remaining() != 0)
+            cout<<"Records read from columns do not match"<<endl;
+    }
+    {
+        // a corrupt count only adds the rows actually there, and those go
+        istringstream huge_columns_in(string(huge_out.begin(), huge_out.end()));
+        BinaryStreamReader huge_columns_reader(huge_columns_in);
+        huge_columns_reader.use_error_codes();
+        vector<record> huge_columns_read(1, record(99, "kept"));
+        huge_columns_reader>>as_columns(huge_columns_read);
+        if(huge_columns_reader.error() != read_end_of_file || huge_columns_read.size() != 1)
+            cout<<"Reading a corrupt column count: "<<read_error_message(huge_columns_reader.error())<<endl;
+    }
+
+    // standard containers
+    unordered_map<string, int> um_data = {{"one", 1}, {"two", 2}, {"three", 3}};
+    unordered_set<long> us_data = {5, -7, 1L << 40};
+    set<string> set_data = {"b", "a", "c"};
+    deque<double> deque_data = {0.5, -1.5, 2.5};
+    list<string> list_data = {"x", "", "z"};
+    array<int, 4> array_data = {{4, 3, 2, 1}};
+    array<myclass, 2> class_array_data;
+    tuple<int, string, double> tuple_data(7, "seven", 7.5);
+    vector<pair<int, short> > pairs_data = {{1, 2}, {-3, 4}};
+    static_assert(fixed_binary_size<pair<int, short> >::value == 6, "fixed size of pair");
+    static_assert(fixed_binary_size<array<int, 4> >::value == sizeof(uint64_t) + 16, "fixed size of array");
+#if __cplusplus >= 201703L
+    optional<string> optional_data = "present", optional_empty;
+    variant<int, string, double> variant_data = string("alternative 1");
+#endif
+    for(BinaryFormat format : formats)
+    {
+        vector<char> containers_out;
+        {
+            BinaryStreamWriter containers_writer(containers_out, format);
+            containers_writer<<um_data<<us_data<<set_data<<deque_data<<list_data<<array_data<<class_array_data<<tuple_data<<pairs_data;
+#if __cplusplus >= 201703L
+            containers_writer<<optional_data<<optional_empty<<variant_data;
+#endif
+        }
+        BinaryStreamReader containers_reader(containers_out.data(), containers_out.size(), format);
+        unordered_map<string, int> um_read;
+        unordered_set<long> us_read;
+        set<string> set_read;
+        deque<double> deque_read;
+        list<string> list_read;
+        array<int, 4> array_read;
+        array<myclass, 2> class_array_read;
+        tuple<int, string, double> tuple_read;
+        vector<pair<int, short> > pairs_read;
+        containers_reader>>um_read>>us_read>>set_read>>deque_read>>list_read>>array_read>>class_array_read>>tuple_read>>pairs_read;
+        if(um_read != um_data || us_read != us_data || set_read != set_data || deque_read != deque_data
+           || list_read != list_data || array_read != array_data || tuple_read != tuple_data || pairs_read != pairs_data
+           || class_array_read[1].string_mem != class_array_data[1].string_mem)
+            cout<<"Read containers do not match"<<endl;
+#if __cplusplus >= 201703L
+        optional<string> optional_read, optional_empty_read = "not empty";
+        variant<int, string, double> variant_read;
+        containers_reader>>optional_read>>optional_empty_read>>variant_read;
+        if(optional_read != optional_data || optional_empty_read.has_value() || variant_read != variant_data)
+            cout<<"Read optional or variant does not match"<<endl;
+#endif
+        if(containers_reader.bytes_remaining() != 0)
+            cout<<"Bytes left after reading containers: "<<containers_reader.bytes_remaining()<<endl;
+    }
+#if __cplusplus >= 201703L
+    try
+    {
+        vector<char> bad_variant_out;
+        {
+            BinaryStreamWriter bad_variant_writer(bad_variant_out);
+            bad_variant_writer<<variant_index(3)<<1.5;
+        }
+        BinaryStreamReader bad_variant_reader(bad_variant_out.data(), bad_variant_out.size());
+        variant<int, string, double> variant_read;
+        bad_variant_reader>>variant_read;
+        cout<<"Reading a variant with an invalid index did not throw"<<endl;
+    }
+    catch(InvalidDataException&)
+    {
+    }
+#endif
+
+    // object tracking: shared objects written once, cycles terminate
+    shared_ptr<Base> leaf = make_shared<Derived<float> >(1.25f);
+    shared_ptr<Base> other_leaf = make_shared<Derived<string> >("other");
+    vector<shared_ptr<Base> > scene = {leaf, leaf, other_leaf, leaf, nullptr};
+    shared_ptr<graph_node> ring = make_shared<graph_node>();
+    ring->value = 1;
+    ring->next = make_shared<graph_node>();
+    ring->next->value = 2;
+    ring->next->next = ring;
+    unique_ptr<Base> owned(new Derived<float>(2.5f));
+    Base* observers[] = {b1, owned.get(), b1};
+    vector<char> tracked_out, scene_tracked_out, scene_untracked_out;
+    {
+        BinaryStreamWriter tracked_writer(tracked_out, binary_varint);
+        BinaryStreamWriter scene_tracked_writer(scene_tracked_out, binary_varint);
+        BinaryStreamWriter scene_untracked_writer(scene_untracked_out, binary_varint);
+        tracked_writer.track_objects();
+        tracked_writer<<scene<<ring<<owned;
+        for(Base* observer : observers)
+            tracked_writer<<observer;
+        scene_tracked_writer.track_objects();
+        scene_tracked_writer<<scene;
+        scene_untracked_writer<<scene;
+    }
+    if(scene_tracked_out.size() >= scene_untracked_out.size())
+        cout<<"Object tracking did not shrink output: "<<scene_tracked_out.size()<<" bytes | Untracked: "<<scene_untracked_out.size()<<" bytes"<<endl;
+    BinaryStreamReader tracked_reader(tracked_out.data(), tracked_out.size(), binary_varint);
+    tracked_reader.track_objects();
+    vector<shared_ptr<Base> > scene_read;
+    shared_ptr<graph_node> ring_read;
+    unique_ptr<Base> owned_read;
+    Base* observers_read[3];
+    tracked_reader>>scene_read>>ring_read>>owned_read;
+    for(int i=0; i<3; i++)
+        tracked_reader>>observers_read[i];
+    if(scene_read.size() != 5 || scene_read[0] != scene_read[1] || scene_read[0] != scene_read[3]
+       || scene_read[0] == scene_read[2] || scene_read[4] != nullptr
+       || static_cast<Derived<float>*>(scene_read[0].get())->x != 1.25f
+       || static_cast<Derived<string>*>(scene_read[2].get())->x != "other")
+        cout<<"Read shared objects do not match"<<endl;
+    if(!ring_read || ring_read->value != 1 || !ring_read->next || ring_read->next->value != 2 || ring_read->next->next != ring_read)
+        cout<<"Read cycle does not match"<<endl;
+    if(!owned_read || observers_read[1] != owned_read.get() || observers_read[0] != observers_read[2]
+       || static_cast<Derived<float>*>(observers_read[0])->x != static_cast<Derived<float>*>(b1)->x)
+        cout<<"Read tracked raw pointers do not match"<<endl;
+    ring_read->next->next.reset();
+    delete observers_read[0];
+
+    // unique_ptrs with a deleter of their own
+    {
+        int deleted = 0;
+        graph_node* single = new graph_node();
+        single->value = 7;
+        unique_ptr<graph_node, counting_delete> counted(single, counting_delete{&deleted});
+        vector<char> counted_out;
+        {
+            BinaryStreamWriter counted_writer(counted_out);
+            counted_writer.track_objects();
+            counted_writer<<counted;
+        }
+        BinaryStreamReader counted_reader(counted_out.data(), counted_out.size());
+        counted_reader.track_objects();
+        unique_ptr<graph_node, counting_delete> counted_read(nullptr, counting_delete{&deleted});
+        counted_reader>>counted_read;
+        if(!counted_read || counted_read->value != 7)
+            cout<<"Read unique_ptr with a deleter does not match"<<endl;
+        counted_read.reset();
+        if(deleted != 1)
+            cout<<"Deleter of the unique_ptr read not kept: "<<deleted<<endl;
+    }
+
+    // the same objects constructed in an arena, freed all together
+    {
+        Arena arena;
+        BinaryStreamReader arena_reader(tracked_out.data(), tracked_out.size(), binary_varint);
+        arena_reader.track_objects();
+        arena_reader.use_arena(&arena);
+        vector<shared_ptr<Base> > arena_scene;
+        shared_ptr<graph_node> arena_ring;
+        unique_ptr<Base> arena_owned;
+        Base* arena_observers[3];
+        arena_reader>>arena_scene>>arena_ring>>arena_owned;
+        for(int i=0; i<3; i++)
+            arena_reader>>arena_observers[i];
+        if(arena_scene.size() != 5 || arena_scene[0] != arena_scene[1] || arena_scene[0] == arena_scene[2]
+           || static_cast<Derived<float>*>(arena_scene[0].get())->x != 1.25f
+           || static_cast<Derived<string>*>(arena_scene[2].get())->x != "other")
+            cout<<"Shared objects read into an arena do not match"<<endl;
+        if(!arena_ring || arena_ring->next->value != 2 || arena_ring->next->next != arena_ring)
+            cout<<"Cycle read into an arena does not match"<<endl;
+        if(arena_observers[1] != arena_owned.get() || arena_observers[0] != arena_observers[2]
+           || static_cast<Derived<float>*>(arena_observers[0])->x != static_cast<Derived<float>*>(b1)->x)
+            cout<<"Raw pointers read into an arena do not match"<<endl;
+        if(arena.bytes_allocated() == 0)
+            cout<<"Nothing was allocated in the arena"<<endl;
+
+        // untracked polymorphic pointers go to the arena too
+        ifstream arena_is("out.txt", ios::in|ios::binary);
+        BinaryStreamReader untracked_arena_reader(arena_is);
+        REGISTER_TYPE(untracked_arena_reader, Derived<float>);
+        REGISTER_TYPE(untracked_arena_reader, Derived<string>);
+        untracked_arena_reader.use_arena(&arena);
+        size_t before = arena.bytes_allocated();
+        untracked_arena_reader>>char_read>>int_read>>double_read>>string_read>>int_array_read>>str_array_read>>cls_read>>d_cls_read>>v_read>>b_read>>p_read>>m_read;
+        Base* arena_b1;
+        Base* arena_b2;
+        untracked_arena_reader>>arena_b1>>arena_b2;
+        if(arena.bytes_allocated() <= before || static_cast<Derived<string>*>(arena_b2)->x != "hello!")
+            cout<<"Polymorphic pointer not read into the arena"<<endl;
+
+#ifdef SERIALIZE_HAVE_PMR
+        // pmr containers take their storage from the arena as well
+        vector<char> pmr_out;
+        {
+            BinaryStreamWriter pmr_writer(pmr_out);
+            pmr_writer<<v_double<<string_data<<m;
+        }
+        BinaryStreamReader pmr_reader(pmr_out.data(), pmr_out.size());
+        std::pmr::vector<double> pmr_doubles(&arena);
+        std::pmr::string pmr_string(&arena);
+        std::pmr::map<std::pmr::string, int> pmr_map(&arena);
+        before = arena.bytes_allocated();
+        pmr_reader>>pmr_doubles>>pmr_string>>pmr_map;
+        if(!std::equal(v_double.begin(), v_double.end(), pmr_doubles.begin(), pmr_doubles.end())
+           || pmr_string != string_data.c_str() || pmr_map.size() != m.size() || pmr_map["tomatoes"] != 3)
+            cout<<"pmr containers read from the arena do not match"<<endl;
+        if(arena.bytes_allocated() < before + v_double.size() * sizeof(double))
+            cout<<"pmr containers did not allocate from the arena"<<endl;
+#endif
+    }
+    ring->next->next.reset();
+
+    // polymorphic objects written from several threads while another
+    // type is registered
+    {
+        vector<vector<char> > thread_out(4);
+        vector<thread> threads;
+        for(size_t t=0; t<thread_out.size(); t++)
+            threads.emplace_back([&thread_out, t, b1, b2]() {
+                BinaryStreamWriter thread_writer(thread_out[t]);
+                for(int i=0; i<1000; i++)
+                    thread_writer<<b1<<b2;
+            });
+        vector<char> lazy_out;
+        BinaryStreamWriter lazy_writer(lazy_out);
+        REGISTER_TYPE(lazy_writer, Derived<int>);
+        REGISTER_TYPE(lazy_writer, Derived<int>);
+        for(thread & t : threads)
+            t.join();
+        for(size_t t=1; t<thread_out.size(); t++)
+            if(thread_out[t] != thread_out[0])
+                cout<<"Polymorphic objects written from threads differ"<<endl;
+
+        Derived<int> lazy(42);
+        Base* lazy_ptr = &lazy;
+        lazy_writer<<lazy_ptr;
+        lazy_writer.flush();
+        BinaryStreamReader lazy_reader(lazy_out.data(), lazy_out.size());
+        REGISTER_TYPE(lazy_reader, Derived<int>);
+        Base* lazy_read;
+        lazy_reader>>lazy_read;
+        if(static_cast<Derived<int>*>(lazy_read)->x != 42)
+            cout<<"Read lazily registered type: "<<static_cast<Derived<int>*>(lazy_read)->x<<endl;
+        delete lazy_read;
+    }
+
+    // large containers written and read in chunks, in parallel
+    {
+        vector<int> many_ints(10000);
+        vector<string> many_strings(2500);
+        map<int, string> many_pairs;
+        for(size_t i=0; i<many_ints.size(); i++)
+            many_ints[i] = static_cast<int>(i * 7) - 5000;
+        for(size_t i=0; i<many_strings.size(); i++)
+            many_strings[i] = string(i % 17, 'a' + i % 26);
+        for(int i=0; i<3000; i++)
+            many_pairs[i * 3] = to_string(i);
+        for(BinaryFormat format : {binary_native, binary_varint})
+        {
+            vector<char> chunks_out;
+            {
+                BinaryStreamWriter chunks_writer(chunks_out, format);
+                chunks_writer<<as_chunks(many_ints, 1000, 4)<<as_chunks(many_strings, 300, 3)
+                             <<as_chunks(many_pairs, 512)<<int_data;
+            }
+            BinaryStreamReader chunks_reader(chunks_out.data(), chunks_out.size(), format);
+            vector<int> ints_read = {1};
+            vector<string> strings_read;
+            map<int, string> pairs_read;
+            int after_chunks;
+            chunks_reader>>as_chunks(ints_read, 0, 4)>>as_chunks(strings_read)>>as_chunks(pairs_read, 0, 2)>>after_chunks;
+            ints_read.erase(ints_read.begin());
+            if(ints_read != many_ints || strings_read != many_strings || pairs_read != many_pairs
+               || after_chunks != int_data)
+                cout<<"Containers read in chunks do not match"<<endl;
+
+            // truncated in the middle of the chunks
+            BinaryStreamReader cut_reader(chunks_out.data(), chunks_out.size() / 4, format);
+            cut_reader.use_error_codes();
+            ints_read.clear();
+            cut_reader>>as_chunks(ints_read)>>as_chunks(strings_read);
+            if(cut_reader.error() != read_end_of_file || !ints_read.empty())
+                cout<<"Reading truncated chunks: "<<read_error_message(cut_reader.error())<<endl;
+        }
+
+        stringstream chunks_stream;
+        {
+            BinaryStreamWriter chunks_writer(chunks_stream, 4096);
+            chunks_writer<<as_chunks(many_pairs, 100);
+        }
+        BinaryStreamReader chunks_stream_reader(chunks_stream);
+        map<int, string> pairs_read;
+        chunks_stream_reader>>as_chunks(pairs_read);
+        if(pairs_read != many_pairs)
+            cout<<"Map read in chunks from a stream does not match"<<endl;
+
+        // a directory claiming more elements or bytes than are there
+        vector<char> bad_chunks_out;
+        {
+            BinaryStreamWriter bad_chunks_writer(bad_chunks_out);
+            bad_chunks_writer<<(size_t(1) << 40)<<size_t(1)<<(size_t(1) << 40)<<size_t(0);
+            bad_chunks_writer<<size_t(1)<<size_t(1)<<size_t(1)<<(size_t(1) << 40);
+        }
+        BinaryStreamReader bad_chunks_reader(bad_chunks_out.data(), bad_chunks_out.size());
+        bad_chunks_reader.use_error_codes();
+        map<int, string> bad_pairs_read;
+        bad_chunks_reader>>as_chunks(bad_pairs_read);
+        if(bad_chunks_reader.error() != read_invalid_data || !bad_pairs_read.empty())
+            cout<<"Reading chunks of more elements than bytes: "<<read_error_message(bad_chunks_reader.error())<<endl;
+        istringstream bad_chunks_in(string(bad_chunks_out.begin() + 4 * sizeof(size_t), bad_chunks_out.end()));
+        BinaryStreamReader bad_chunks_stream_reader(bad_chunks_in);
+        bad_chunks_stream_reader.use_error_codes();
+        vector<int> bad_ints_read;
+        bad_chunks_stream_reader>>as_chunks(bad_ints_read);
+        if(bad_chunks_stream_reader.error() != read_end_of_file || !bad_ints_read.empty())
+            cout<<"Reading chunks of more bytes than are there: "<<read_error_message(bad_chunks_stream_reader.error())<<endl;
+
+        // a chunk which does not decode leaves the containers as they were
+        vector<char> corrupt_chunks_out;
+        {
+            BinaryStreamWriter corrupt_chunks_writer(corrupt_chunks_out);
+            corrupt_chunks_writer<<uint64_t(2)<<uint64_t(1)<<uint64_t(2)<<uint64_t(12)<<1<<2<<3;
+            corrupt_chunks_writer<<uint64_t(1)<<uint64_t(1)<<uint64_t(1)<<uint64_t(12)<<5<<uint64_t(100);
+        }
+        BinaryStreamReader corrupt_chunks_reader(corrupt_chunks_out.data(), corrupt_chunks_out.size());
+        corrupt_chunks_reader.use_error_codes();
+        vector<int> corrupt_ints_read = {9};
+        corrupt_chunks_reader>>as_chunks(corrupt_ints_read);
+        if(corrupt_chunks_reader.error() != read_invalid_data || corrupt_ints_read != vector<int>{9})
+            cout<<"Reading a corrupt chunk of ints: "<<read_error_message(corrupt_chunks_reader.error())<<endl;
+        size_t corrupt_ints_size = 4 * sizeof(uint64_t) + 3 * sizeof(int);
+        BinaryStreamReader corrupt_pairs_reader(corrupt_chunks_out.data() + corrupt_ints_size,
+                                                corrupt_chunks_out.size() - corrupt_ints_size);
+        corrupt_pairs_reader.use_error_codes();
+        map<int, string> corrupt_pairs_read = {{9, "kept"}};
+        corrupt_pairs_reader>>as_chunks(corrupt_pairs_read);
+        if(corrupt_pairs_reader.error() != read_end_of_file || corrupt_pairs_read != map<int, string>{{9, "kept"}})
+            cout<<"Reading a corrupt chunk of pairs: "<<read_error_message(corrupt_pairs_reader.error())<<endl;
+    }
+
+    // read the file written above through a memory mapping, taking
+    // views of the string and int array instead of copying them
+    MappedFile mapped("out.txt");
+    BinaryStreamReader mapped_reader(mapped.data(), mapped.size());
+    char mapped_char_read;
+    int mapped_int_read;
+    double mapped_double_read;
+    array_view<char> string_view_read;
+    array_view<int> int_array_view_read;
+    mapped_reader>>mapped_char_read>>mapped_int_read>>mapped_double_read>>string_view_read>>int_array_view_read;
+    if(mapped_char_read != char_data || mapped_int_read != int_data || mapped_double_read != double_data)
+        cout<<"Read from mapped file does not match written data"<<endl;
+    if(string(string_view_read.bytes(), string_view_read.size()) != string_data)
+        cout<<"Read string view: "<<string(string_view_read.bytes(), string_view_read.size())<<endl;
+    if(int_array_view_read.size() != 10 || int_array_view_read[9] != int_array[9])
+        cout<<"Read int array view of size: "<<int_array_view_read.size()<<endl;
+#if __cplusplus >= 201703L
+    BinaryStreamReader string_view_reader(mapped.data(), mapped.size());
+    std::string_view string_view_target;
+    string_view_reader>>mapped_char_read>>mapped_int_read>>mapped_double_read>>string_view_target;
+    if(string_view_target != string_data)
+        cout<<"Read std::string_view: "<<string_view_target<<endl;
+#endif
+    try
+    {
+        ifstream view_is("out.txt", ios::in|ios::binary);
+        BinaryStreamReader view_stream_reader(view_is);
+        view_stream_reader>>string_view_read;
+        cout<<"Reading a view from a stream did not throw"<<endl;
+    }
+    catch(ViewUnavailableException&)
+    {
+    }
     return 0;
 }
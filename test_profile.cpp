@@ -0,0 +1,164 @@
+#define SERIALIZE_PROFILE
+#include "binary_streamwriter.hpp"
+#include "binary_streamreader.hpp"
+#include "text_streamwriter.hpp"
+#include "text_streamreader.hpp"
+#include "members.hpp"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Base
+{
+    Base(): b(0) { }
+    int b;
+    virtual ~Base() { }
+};
+
+struct Derived: public Base
+{
+    string label;
+};
+
+template <class Writer>
+void serialize(Writer & w, const Derived & d)
+{
+    w<<d.b<<d.label;
+}
+
+template <class Reader>
+void deserialize(Reader & r, Derived & d)
+{
+    r>>d.b>>d.label;
+}
+
+struct row
+{
+    int id;
+    vector<int> values;
+    string name;
+    SERIALIZE_MEMBERS(row, id, values, name)
+};
+
+// sum of the self bytes, which should be every byte written or read
+uint64_t self_total(const Profiler & profile)
+{
+    uint64_t total = 0;
+    for(const Profiler::entry & e : profile.entries())
+        total += e.self_bytes;
+    return total;
+}
+
+// first entry whose name contains `part', or one with no calls
+Profiler::entry find_entry(const Profiler & profile, const string & part)
+{
+    for(const Profiler::entry & e : profile.entries())
+        if(e.name.find(part) != string::npos)
+            return e;
+    Profiler::entry none = {"", false, 0, 0, 0, 0, 0};
+    return none;
+}
+
+int main()
+{
+    vector<row> samples(3);
+    for(int i=0; i<3; i++)
+    {
+        samples[i].id = i;
+        samples[i].values.assign(100 * (i + 1), i);
+        samples[i].name = string(i + 1, 'n');
+    }
+    Derived* shapes[2] = {new Derived, new Derived};
+    shapes[0]->label = "first";
+    shapes[1]->label = "second, a little longer";
+
+    // binary, in memory
+    vector<char> out;
+    Profiler write_profile;
+    {
+        BinaryStreamWriter writer(out);
+        REGISTER_TYPE(writer, Derived);
+        writer.set_profiler(&write_profile);
+        writer<<samples;
+        for(Base* s : shapes)
+            writer<<s;
+    }
+    if(self_total(write_profile) != out.size())
+        cout<<"Profiled bytes written: "<<self_total(write_profile)<<" | Written: "<<out.size()<<endl;
+    Profiler::entry values = find_entry(write_profile, "vector<int");
+    if(values.calls != 3 || values.bytes != 3 * sizeof(uint64_t) + 600 * sizeof(int))
+        cout<<"Profile of vector<int> does not match"<<endl;
+    Profiler::entry key = find_entry(write_profile, "Derived");
+    if(!key.registered_key || key.calls != 2 || key.bytes == 0)
+        cout<<"Profile of registered type does not match"<<endl;
+    Profiler::entry outer = find_entry(write_profile, "vector<row");
+    if(outer.calls != 1 || outer.bytes <= values.bytes || outer.self_bytes != 0)
+        cout<<"Profile of nested calls does not match"<<endl;
+    vector<Profiler::entry> all = write_profile.entries();
+    if(all.empty() || all.front().self_bytes < all.back().self_bytes)
+        cout<<"Profile entries not sorted by self bytes"<<endl;
+
+    Profiler read_profile;
+    BinaryStreamReader reader(out.data(), out.size());
+    REGISTER_TYPE(reader, Derived);
+    reader.set_profiler(&read_profile);
+    vector<row> samples_read;
+    Base* shapes_read[2];
+    reader>>samples_read>>shapes_read[0]>>shapes_read[1];
+    if(self_total(read_profile) != out.size())
+        cout<<"Profiled bytes read: "<<self_total(read_profile)<<" | Read: "<<out.size()<<endl;
+    key = find_entry(read_profile, "Derived");
+    if(key.calls != 2 || static_cast<Derived*>(shapes_read[1])->label != shapes[1]->label)
+        cout<<"Profile of registered type read does not match"<<endl;
+
+    // text, on a stream; the profiler is shared and cleared in between
+    write_profile.clear();
+    if(!write_profile.entries().empty())
+        cout<<"Profile not cleared"<<endl;
+    stringstream ss;
+    {
+        TextStreamWriter text_writer(ss);
+        REGISTER_TYPE(text_writer, Derived);
+        text_writer.set_profiler(&write_profile);
+        text_writer<<samples<<shapes[0];
+    }
+    if(self_total(write_profile) != ss.str().size())
+        cout<<"Profiled text bytes: "<<self_total(write_profile)<<" | Written: "<<ss.str().size()<<endl;
+    TextStreamReader text_reader(ss);
+    REGISTER_TYPE(text_reader, Derived);
+    read_profile.clear();
+    text_reader.set_profiler(&read_profile);
+    samples_read.clear();
+    Base* text_shape_read;
+    text_reader>>samples_read>>text_shape_read;
+    if(samples_read.size() != 3 || samples_read[2].values != samples[2].values)
+        cout<<"Profiled text read does not match"<<endl;
+    values = find_entry(read_profile, "vector<int");
+    if(values.calls != 3 || values.bytes == 0)
+        cout<<"Profile of text vector<int> read does not match"<<endl;
+
+    // nothing is recorded without a profiler
+    vector<char> unprofiled_out;
+    {
+        BinaryStreamWriter unprofiled_writer(unprofiled_out);
+        unprofiled_writer<<samples;
+    }
+    if(unprofiled_out.size() > out.size() || !equal(unprofiled_out.begin(), unprofiled_out.end(), out.begin()))
+        cout<<"Unprofiled writer wrote differently"<<endl;
+
+    ostringstream report;
+    read_profile.report(report);
+    if(report.str().find("vector<int") == string::npos)
+        cout<<"Report does not list vector<int>"<<endl;
+
+    for(Base* s : shapes)
+        delete s;
+    for(Base* s : shapes_read)
+        delete s;
+    delete text_shape_read;
+    return 0;
+}
@@ -2,9 +2,18 @@
 #include "text_streamreader.hpp"
 #include "text_streamwriter.hpp"
 
+#include <algorithm>
+#include <clocale>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <list>
+#include <array>
+#include <tuple>
 #include <typeinfo>
 
 using namespace std;
@@ -86,6 +95,10 @@ int main()
   char char_data = 'C';
   int int_data = 225;
   double double_data = 351258935;
+  double numbers_data[] = {0.1, -1e-300, 1.0 / 3, 6.02214076e23};
+  long long ll_data = -9223372036854775807LL - 1;
+  unsigned long long ull_data = 18446744073709551615ULL;
+  float float_data = 3.14159274f;
   int int_array[10] = {1,2,3,4,5,6,7,8,9,10};
   string str_array[] = {"abc", "another one", "third\none", "fourth"};
   //string string_data = "this is a string.";
@@ -100,14 +113,15 @@ int main()
   ofstream os("out.txt");
   TextStreamWriter writer(os);
   
-  //vinfo.push_back(new info<TextStreamWriter,myclass>(writer));
-  //vinfo.push_back(new info<TextStreamWriter,derived_myclass>(writer));
+  REGISTER_TYPE(writer, myclass);
+  REGISTER_TYPE(writer, derived_myclass);
 
   myclass* bptrtod = &d_cls;
   //get_matching_type(bptrtod)->call_serialize(bptrtod);
 
   writer<<bptrtod;
   writer<<char_data<<int_data<<double_data<<string_data<<int_array<<str_array<<cls<<d_cls;
+  writer<<numbers_data<<ll_data<<ull_data<<float_data;
   writer<<d_cls;
   os.close();
 
@@ -123,12 +137,17 @@ int main()
   ifstream is("out.txt");
   TextStreamReader reader(is);
 
-  //vinfo.push_back(new info<TextStreamReader,myclass>(reader));
-  //vinfo.push_back(new info<TextStreamReader,derived_myclass>(reader));
+  REGISTER_TYPE(reader, myclass);
+  REGISTER_TYPE(reader, derived_myclass);
   
   myclass* bptrempty;
   reader>>bptrempty;
   reader>>char_read>>int_read>>double_read>>string_read>>int_array_read>>str_array_read>>cls_read>>d_cls_read;
+  double numbers_read[4];
+  long long ll_read = 0;
+  unsigned long long ull_read = 0;
+  float float_read;
+  reader>>numbers_read>>ll_read>>ull_read>>float_read;
   //reader>>d_cls_read;
   is.close();
   
@@ -141,5 +160,106 @@ int main()
   if (string_read != string_data)
     cout<<"Read string: "<<string_read<<" | Expected string: "<<string_data<<endl;
 
+  for (int i = 0; i < 4; ++i)
+    if (numbers_read[i] != numbers_data[i])
+      cout<<"Read double: "<<numbers_read[i]<<" | Expected double: "<<numbers_data[i]<<endl;
+  if (ll_read != ll_data || ull_read != ull_data)
+    cout<<"Read long long: "<<ll_read<<", "<<ull_read<<endl;
+  if (float_read != float_data)
+    cout<<"Read float: "<<float_read<<" | Expected float: "<<float_data<<endl;
+  for (int i = 0; i < 10; ++i)
+    if (int_array_read[i] != int_array[i])
+      cout<<"Read int: "<<int_array_read[i]<<" | Expected int: "<<int_array[i]<<endl;
+
+  // vectors long enough to span several bulk-read blocks, each followed
+  // by another item which must be left in the stream
+  vector<int> ints_data;
+  vector<double> doubles_data;
+  for (int i = 0; i < 5000; ++i)
+    {
+      ints_data.push_back(i % 7 == 0 ? -i * 104729 : i);
+      doubles_data.push_back(i / 7.0);
+    }
+  stringstream ss;
+  {
+    TextStreamWriter vwriter(ss);
+    vwriter<<ints_data<<int_data<<doubles_data<<string_data;
+  }
+  vector<int> ints_read;
+  vector<double> doubles_read;
+  TextStreamReader vreader(ss);
+  vreader>>ints_read>>int_read>>doubles_read>>string_read;
+  if (ints_read != ints_data || int_read != int_data)
+    cout<<"Bulk read of vector<int> failed"<<endl;
+  if (doubles_read != doubles_data || string_read != string_data)
+    cout<<"Bulk read of vector<double> failed"<<endl;
+
+  // standard containers
+  unordered_map<string, int> um_data = {{"one", 1}, {"two words", 2}};
+  set<int> set_data = {3, 1, 2};
+  list<string> list_data = {"x", "y z"};
+  array<double, 3> array_data = {{0.5, 1.0 / 3, -2}};
+  tuple<int, string, float> tuple_data(7, "seven", 7.5f);
+  stringstream containers;
+  {
+    TextStreamWriter cwriter(containers);
+    cwriter<<um_data<<set_data<<list_data<<array_data<<tuple_data;
+  }
+  unordered_map<string, int> um_read;
+  set<int> set_read;
+  list<string> list_read;
+  array<double, 3> array_read;
+  tuple<int, string, float> tuple_read;
+  TextStreamReader creader(containers);
+  creader>>um_read>>set_read>>list_read>>array_read>>tuple_read;
+  if (um_read != um_data || set_read != set_data || list_read != list_data
+      || array_read != array_data || tuple_read != tuple_data)
+    cout<<"Read containers do not match"<<endl;
+
+  // the fewest digits which read back the same, whatever the standard
+  double shortest_data[] = {1.0 / 3, 5e-324, 0.1};
+  const char* shortest_text[] = {"0.3333333333333333", "5e-324", "0.1"};
+  for (int i = 0; i < 3; ++i)
+    {
+      char text[max_number_length];
+      string written(text, format_number(text, shortest_data[i]));
+      if (written != shortest_text[i])
+	cout<<"Written double: "<<written<<" | Expected: "<<shortest_text[i]<<endl;
+    }
+
+  // numbers do not depend on the global locale, if one with a decimal
+  // comma is installed
+  const char* comma_locales[] = {"de_DE.UTF-8", "fr_FR.UTF-8", "de_DE", "fr_FR"};
+  for (const char* name : comma_locales)
+    if (setlocale(LC_ALL, name))
+      {
+	stringstream localized;
+	{
+	  TextStreamWriter lwriter(localized);
+	  lwriter<<numbers_data<<float_data;
+	}
+	if (localized.str().find(',') != string::npos)
+	  cout<<"Numbers written with a decimal comma: "<<localized.str()<<endl;
+	double localized_read[4];
+	float localized_float_read = 0;
+	TextStreamReader lreader(localized);
+	lreader>>localized_read>>localized_float_read;
+	if (!equal(numbers_data, numbers_data + 4, localized_read) || localized_float_read != float_data)
+	  cout<<"Numbers read in locale "<<name<<" do not match"<<endl;
+	setlocale(LC_ALL, "C");
+	break;
+      }
+
+  stringstream bad("3\n1\n2x\n3\n");
+  TextStreamReader bad_reader(bad);
+  try
+    {
+      bad_reader>>ints_read;
+      cout<<"Malformed number not detected"<<endl;
+    }
+  catch (FailBitException &)
+    {
+    }
+
   return 0;
 }
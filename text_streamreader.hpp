@@ -14,12 +14,15 @@
 #ifndef TEXT_STREAMREADER_HPP
 #define TEXT_STREAMREADER_HPP
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <typeinfo>
 
 #include "streamreader.hpp"
 #include "stl_serialize.hpp"
+#include "number_format.hpp"
 
 /**
  * Reads from a stream with data serialized using TextStreamWriter.
@@ -77,7 +80,8 @@ public:
    *
    * @param string_data string to read into
    */
-  void load(std::string & string_data)
+  template <typename Traits, typename Alloc>
+  void load(std::basic_string<char, Traits, Alloc> & string_data)
   {
     read_and_check_types(string_data);
     read_data(string_data);
@@ -93,6 +97,71 @@ public:
     read_and_check_types(cstring_data);
     read_data(cstring_data);
   }
+
+  /** 
+   * Read count numbers in one pass. Blocks of the stream buffer are
+   * copied out with sgetn and split on whitespace a vector register
+   * at a time; the stream state is checked once at the end instead of
+   * per element.
+   *
+   * Every number is followed by at least one whitespace character, so
+   * each unread number takes at least two characters: asking for no
+   * more than that never consumes anything past the last one.
+   *
+   * @param data first element to read into
+   * @param count number of elements
+   */
+  template <typename T>
+  typename std::enable_if<is_text_number<T>::value>::type
+  load_elements(T* data, size_t count)
+  {
+    const size_t block_size = 4096;
+    char block[block_size];
+    size_t carried = 0;		// start of a number cut off by the block end
+    size_t parsed = 0;
+    std::streambuf* buf = stream->rdbuf();
+
+    if (count > 0 && !stream->good())
+      stream->setstate(std::ios::failbit);
+
+    while (parsed < count && stream->good())
+      {
+	size_t unread = 2 * (count - parsed) - (carried ? 1 : 0);
+	size_t wanted = std::min(block_size - carried, unread);
+	size_t got = static_cast<size_t>(buf->sgetn(block + carried, wanted));
+	bool at_eof = got < wanted;
+	const char* p = block;
+	const char* end = block + carried + got;
+
+	while (parsed < count)
+	  {
+	    p = skip_number_space(p, end);
+	    if (p == end)
+	      break;
+	    const char* token_end = find_number_space(p, end);
+	    if (token_end == end && !at_eof)
+	      break;
+	    if (!parse_number(p, token_end, data[parsed]))
+	      {
+		stream->setstate(std::ios::failbit);
+		break;
+	      }
+	    ++parsed;
+	    p = token_end;
+	  }
+
+	carried = end - p;
+	if (at_eof)
+	  stream->setstate(std::ios::eofbit | (parsed < count ? std::ios::failbit
+					       : std::ios::goodbit));
+	else if (carried >= max_number_length)
+	  stream->setstate(std::ios::failbit);
+	else
+	  std::memmove(block, p, carried);
+      }
+    if (!check_stream())
+      std::fill(data + parsed, data + count, T());
+  }
   
 private:
 
@@ -114,9 +183,76 @@ private:
   template <class T>
   typename std::enable_if<std::is_fundamental<T>::value,void>::type
   read_data(T & T_data)
+  {
+    read_value(T_data, is_text_number<T>());
+  }
+
+  template <class T>
+  void read_value(T & T_data, std::false_type)
   {
     *stream>>T_data;
-    checkandthrowBasicException(stream);
+    if (!check_stream())
+      T_data = T();
+  }
+
+  /** 
+   * Numbers are parsed straight from the stream buffer, without going
+   * through the stream's locale.
+   *
+   * @param T_data number to read into
+   */
+  template <class T>
+  void read_value(T & T_data, std::true_type)
+  {
+    char text[max_number_length];
+    size_t len = read_token(text);
+    if (len > 0 && !parse_number(text, text + len, T_data))
+      stream->setstate(std::ios::failbit);
+    if (!check_stream())
+      T_data = T();
+  }
+
+  /** 
+   * Skip whitespace and copy the following non-whitespace characters
+   * (at most max_number_length of them) out of the stream buffer.
+   * Sets eofbit if the end of the stream is reached, and failbit if
+   * there is no token or it is too long, like the >> operator.
+   *
+   * @param text buffer of max_number_length characters
+   *
+   * @return length of the token
+   */
+  size_t read_token(char* text)
+  {
+    typedef std::char_traits<char> traits;
+    if (!stream->good())
+      {
+	stream->setstate(std::ios::failbit);
+	return 0;
+      }
+
+    std::streambuf* buf = stream->rdbuf();
+    traits::int_type c = buf->sgetc();
+    while (!traits::eq_int_type(c, traits::eof()) && is_number_space(c))
+      c = buf->snextc();
+
+    size_t len = 0;
+    while (!traits::eq_int_type(c, traits::eof()) && !is_number_space(c))
+      {
+	if (len == max_number_length)
+	  {
+	    stream->setstate(std::ios::failbit);
+	    return 0;
+	  }
+	text[len++] = traits::to_char_type(c);
+	c = buf->snextc();
+      }
+
+    if (traits::eq_int_type(c, traits::eof()))
+      stream->setstate(std::ios::eofbit);
+    if (len == 0)
+      stream->setstate(std::ios::failbit);
+    return len;
   }
 
   /** 
@@ -133,13 +269,9 @@ private:
 
     *this>>stored_array_size;
     if (stored_array_size != array_size)
-      {
-	// throw exception
-	throw SizeMismatchException(stored_array_size, array_size);
-      }
+      report_error(read_size_mismatch, SizeMismatchException(stored_array_size, array_size));
 
-    for (size_t i = 0; i < array_size; ++i)
-	*this>>T_array_data[i];
+    deserialize_elements(*this, T_array_data, array_size);
   }
 
   /** 
@@ -150,18 +282,17 @@ private:
    * 
    * @param string_data string to read into
    */
-  void read_data(std::string & string_data)
+  template <typename Traits, typename Alloc>
+  void read_data(std::basic_string<char, Traits, Alloc> & string_data)
   {
-    size_t len;
-    *stream>>len;
+    size_t len = 0;
+    read_value(len, std::true_type());
     stream->get();		// space
-    char* s = new char[len + 1];
 
-    stream->read(s, len);
-    s[len] = '\0';
-    string_data = std::string(s, len);
-    delete[] s;
-    checkandthrowBasicException(stream);
+    // straight into the string's own storage, no temporary buffer
+    read_characters(string_data, len);
+    if (!check_stream())
+      string_data.clear();
   }
 
   /** 
@@ -173,19 +304,28 @@ private:
    */
   void read_data(char* & cstring_data)
   {
-    size_t len;
-    *stream>>len;
+    size_t len = 0;
+    read_value(len, std::true_type());
     stream->get();
-    char* s = new char[len + 1];
 
-    stream->read(s,len);
-    s[len] = '\0';
-    cstring_data = s;
-
-    checkandthrowBasicException(stream);
+    std::string characters;
+    read_characters(characters, len);
+    cstring_data = new char[characters.size() + 1];
+    std::memcpy(cstring_data, characters.c_str(), characters.size() + 1);
+    check_stream();
   }
 };
 
+/** 
+ * Arrays and vectors of numbers are read in bulk.
+ */
+template <typename T>
+typename std::enable_if<is_text_number<T>::value>::type
+deserialize_elements(TextStreamReader & reader, T* data, size_t count)
+{
+  reader.load_elements(data, count);
+}
+
 // Trivialized since we decided to drop serializing the type
 template <class T>
 bool TextStreamReader::read_and_check_types(const T & data)
@@ -22,11 +22,16 @@
 
 #include "streamwriter.hpp"
 #include "stl_serialize.hpp"
+#include "number_format.hpp"
 #include "types.hpp"
 
 /**
  * Serializes data in a text format. Format chosen is: one item per
  * line.
+ *
+ * Lines end with a plain '\n'; the stream is only flushed by flush()
+ * and on destruction, unless the writer is asked to flush after every
+ * item.
  */
 class TextStreamWriter: public StreamWriter
 {
@@ -35,15 +40,29 @@ public:
    * Needs an opened ostream object.
    *
    * @param m_stream Open ostream object
+   * @param flush_each_item flush the stream after every item written,
+   * as with std::endl (slow on files: one write per item)
    */
-  TextStreamWriter(ostream& m_stream): StreamWriter(m_stream)
+  TextStreamWriter(ostream& m_stream, bool flush_each_item = false):
+    StreamWriter(m_stream), flush_each(flush_each_item)
   { }
 
   /** 
-   * Trivial destructor
+   * Flushes the stream, which must still exist. Does not close it.
    */
   ~TextStreamWriter()
-  { }
+  {
+    stream->flush();
+  }
+
+  /** 
+   * Flush the stream, eg. at a checkpoint after which the data
+   * written so far must be visible to readers.
+   */
+  void flush()
+  {
+    stream->flush();
+  }
 
   /** 
    * Write fundamental types.
@@ -63,7 +82,8 @@ public:
    *
    * @param string_data given string
    */
-  void save(const std::string & string_data)
+  template <typename Traits, typename Alloc>
+  void save(const std::basic_string<char, Traits, Alloc> & string_data)
   {
     write_type(string_data);
     write_data(string_data);
@@ -150,8 +170,7 @@ private:
     // Get the matching Info object from the list (must have been
     // registered by the user first) and write its key.
     // Throws an exception if the correct Info class was not found.
-    std::string type_key(InfoList<TextStreamWriter>::get_matching_type(T_data)->key());
-    *this<<type_key;
+    *this<<InfoList<TextStreamWriter>::get_matching_type(T_data)->key();
   }
 
   // Make it do nothing - will not write type for non-polymorphics
@@ -170,7 +189,35 @@ private:
   template <class T>
   void write_data(const T & T_data)
   {
-    *stream<<T_data<<std::endl;
+    write_value(T_data, is_text_number<T>());
+  }
+
+  template <class T>
+  void write_value(const T & T_data, std::false_type)
+  {
+    *stream<<T_data;
+    end_item();
+  }
+
+  /** 
+   * Numbers are formatted without going through the stream's locale
+   * and written with a single write. Floating point numbers are
+   * written in the shortest form that reads back exactly.
+   *
+   * @param T_data number to serialize
+   */  
+  template <class T>
+  void write_value(const T & T_data, std::true_type)
+  {
+    write_number(T_data);
+    end_item();
+  }
+
+  template <class T>
+  void write_number(const T & T_data)
+  {
+    char text[max_number_length];
+    stream->write(text, format_number(text, T_data));
   }
 
   /** 
@@ -181,7 +228,9 @@ private:
    */
   void write_data(const char* cstring_data)
   {
-    *stream<<strlen(cstring_data)<<" "<<cstring_data<<std::endl;
+    write_number(strlen(cstring_data));
+    *stream<<" "<<cstring_data;
+    end_item();
   }
   
   /** 
@@ -189,10 +238,26 @@ private:
    *
    * @param string_data string to be serialized
    */
-  void write_data(const std::string& string_data)
+  template <typename Traits, typename Alloc>
+  void write_data(const std::basic_string<char, Traits, Alloc>& string_data)
   {
-    *stream<<string_data.size()<<" "<<string_data<<std::endl;
+    write_number(string_data.size());
+    stream->put(' ');
+    stream->write(string_data.data(), string_data.size());
+    end_item();
   }
+
+  /** 
+   * Every item ends with a newline.
+   */
+  void end_item()
+  {
+    stream->put('\n');
+    if (flush_each)
+      stream->flush();
+  }
+
+  bool flush_each;		/**< flush after every item */
 };
 
 #endif // TEXT_STREAMWRITER_HPP
@@ -19,13 +19,20 @@
 #define _TYPES_HPP
 
 #include "common.hpp"
+#include "arena.hpp"
+#include "profiler.hpp"
 #include <algorithm>
+#include <atomic>
 #include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <typeindex>
 #include <typeinfo>
-#include <map>
+#include <unordered_map>
+#include <vector>
 
 class StreamReader;
 class StreamWriter;
@@ -33,10 +40,11 @@ class InfoBase;
 
 using namespace std;
 
-// Registers a type T by creating a new Info<T> object and setting the
-// key to be the literal "T", i.e., the name of the type.
+// Registers a type T by creating an Info<T> object and setting the
+// key to be the literal "T", i.e., the name of the type. Registering
+// a type again does nothing.
 #define REGISTER_TYPE(writer,type)				\
-  register_type(writer,new Info< type > (string(#type)) );
+  register_type(writer,Info< type > (string(#type)) );
 
 /**
  * Exception to be thrown when it is found that there is no registered
@@ -57,21 +65,21 @@ public:
    *
    * @param type_key key of the type which is not registered.
    */
-  TypeNotRegisteredException(string type_key): m_type_key(type_key) { }
+  TypeNotRegisteredException(string type_key):
+    m_type_key(type_key),
+    m_message("A derived class type was not registered. The type key is: " + type_key)
+  { }
   
   virtual const char* what() const throw(){
     if (m_type_key == "")
       return "A derived class type was not registered. (Can't tell which.)";
-	
-    stringstream ss (stringstream::in | stringstream::out);
 
-    ss<<"A derived class type was not registered. The type key is: "<<m_type_key;
-
-    return ss.str().c_str();
+    return m_message.c_str();
   }
 
 private:
   string m_type_key;		// the 'key' of the type, if we know it
+  string m_message;		// what(), kept so that the pointer stays valid
 };
 
 
@@ -116,7 +124,7 @@ public:
    *
    * @return key (string)
    */
-  virtual string key() { return m_key; }
+  virtual const string & key() { return m_key; }
 
 private:
   string m_key;
@@ -184,7 +192,15 @@ public:
    *
    * @return key, a unique string for each type represented.
    */
-  string key() { return get_key(); }
+  const string & key() { return get_key(); }
+
+  /** 
+   * Return the type represented by this object, for indexing by the
+   * dynamic type of an object (typeid(*object)).
+   *
+   * @return type_index of the represented type
+   */
+  type_index type() { return get_type(); }
 
   /** 
    * Check if the type represented by this object is the same as the
@@ -210,14 +226,22 @@ public:
    */
   void call_serialize(Writer & writer, void* other)
   {
+    SERIALIZE_PROFILE_KEY(writer, key());
     cast_and_call_serialize(writer, other);
   }
     
 private:
-  virtual string get_key()
+  virtual const string & get_key()
   {
     NOT_IMPLEMENTED("not implemented get_key() called!");
-    return "";
+    static const string no_key;
+    return no_key;
+  }
+
+  virtual type_index get_type()
+  {
+    NOT_IMPLEMENTED("not implemented get_type() called!");
+    return typeid(void);
   }
   
   virtual void cast_and_call_serialize(Writer & writer, void* other)
@@ -257,7 +281,9 @@ public:
 
 private:
 
-  virtual string get_key() { return m_info.key(); }
+  virtual const string & get_key() { return m_info.key(); }
+
+  virtual type_index get_type() { return typeid(InfoType); }
   
   virtual void cast_and_call_serialize(Writer & writer, void* other)
   {
@@ -289,7 +315,9 @@ public:
   
   virtual ~TiedInfoBase() { }
 
-  string key() { return get_key(); }
+  const string & key() { return get_key(); }
+
+  type_index type() { return get_type(); }
   
   bool is_same_type(void* other, const type_info & id_info)
   {
@@ -309,20 +337,61 @@ public:
    */
   void* call_deserialize(Reader & reader)
   {
-    return construct_and_call_deserialize(reader);
+    void* object = construct(reader.arena());
+    deserialize_into(reader, object);
+    return object;
+  }
+
+  /** 
+   * Construct an object of the represented type, without reading
+   * anything into it yet.
+   *
+   * @param arena arena to create the object in, or nullptr to
+   * allocate it with new
+   *
+   * @return Pointer to the constructed object
+   */
+  void* construct(Arena* arena)
+  {
+    return construct_object(arena);
+  }
+
+  /** 
+   * Deserialize into an object constructed by construct().
+   *
+   * @param reader StreamReader descendant
+   * @param object object of the represented type
+   */
+  void deserialize_into(Reader & reader, void* object)
+  {
+    SERIALIZE_PROFILE_KEY(reader, key());
+    cast_and_call_deserialize(reader, object);
   }
     
 private:
 
-  virtual string get_key()
+  virtual const string & get_key()
   {
     NOT_IMPLEMENTED("not implemented get_key() called!");
-    return "";
+    static const string no_key;
+    return no_key;
+  }
+
+  virtual type_index get_type()
+  {
+    NOT_IMPLEMENTED("not implemented get_type() called!");
+    return typeid(void);
   }
   
-  virtual void* construct_and_call_deserialize(Reader & reader)
+  virtual void* construct_object(Arena*)
   {
-    NOT_IMPLEMENTED("Not implemented construct_and_call_deserialize called!\n");
+    NOT_IMPLEMENTED("Not implemented construct_object called!\n");
+    return nullptr;
+  }
+
+  virtual void cast_and_call_deserialize(Reader &, void*)
+  {
+    NOT_IMPLEMENTED("Not implemented cast_and_call_deserialize called!\n");
   }
   
   virtual bool check_if_same_type(void* other, const type_info & id_info)
@@ -347,23 +416,34 @@ public:
 
 private:
 
-  virtual string get_key() { return m_info.key(); }
+  virtual const string & get_key() { return m_info.key(); }
+
+  virtual type_index get_type() { return typeid(InfoType); }
 
   /** 
    * The type of the object is assumed to be the template parameter of
-   * this class, InfoType. Constructs an object of this type and
-   * deserializes into that object.
+   * this class, InfoType.
    *
-   * @param reader StreamReader descendant
+   * @param arena arena to create the object in, if any
    *
-   * @return Pointer to the created object
+   * @return Pointer to a new object of this type
    */  
-  virtual void* construct_and_call_deserialize(Reader & reader)
+  virtual void* construct_object(Arena* arena)
   {
-    InfoType* derived_ptr = new InfoType;
-    reader>>*derived_ptr;
-    
-    return derived_ptr;
+    if (arena)
+      return arena->create<InfoType>();
+    return new InfoType;
+  }
+
+  /** 
+   * Deserializes into an object of type InfoType.
+   *
+   * @param reader StreamReader descendant
+   * @param object the object, constructed by construct_object
+   */
+  virtual void cast_and_call_deserialize(Reader & reader, void* object)
+  {
+    reader>>*static_cast<InfoType*>(object);
   }
 
   virtual bool check_if_same_type(void* other, const type_info & id_info)
@@ -379,20 +459,57 @@ private:
 // StreamReader/StreamWriter class so that the corresponding TiedInfo
 // objects can be used rather than the plain Info objects which do not
 // have the capability to serialize or deserialize.
+//
+// Types are indexed both by key (used while deserializing) and by
+// type_index (used while serializing), so that both lookups are
+// constant time however many types are registered.
+//
+// The indexes are copied on write: types registered (under a mutex)
+// are added to the next table, which the first lookup after them
+// publishes atomically, so lookups from any number of threads neither
+// lock nor allocate once it is out, and types may still be registered
+// at any time, eg. lazily by plugins. Registering many types in a row
+// copies the table once, not once per type. Tables replaced are kept
+// until the end of the program, as a lookup may still be using one.
 template <class ReaderWriter>
 struct InfoList
 {
   using ptr_type = TiedInfoBase<ReaderWriter>*;
 
-  static map<string,ptr_type> info_list;
+  /**
+   * An immutable snapshot of the registered types.
+   */
+  struct table
+  {
+    unordered_map<string,ptr_type> by_key;
+    unordered_map<type_index,ptr_type> by_type;
+  };
 
+  /** 
+   * Add a type, taking ownership of `tied_info'. If a type with the
+   * same key is registered already, `tied_info' is deleted instead.
+   *
+   * @param tied_info TiedInfo object for the type, allocated with new
+   */
   static void add_type(ptr_type tied_info)
   {
+    unique_ptr<TiedInfoBase<ReaderWriter> > owned_info(tied_info);
+    registry & r = owner();
+    lock_guard<mutex> lock(r.writing);
+
+    if (!r.next)
+      {
+	const table* old_table = current.load(memory_order_relaxed);
+	r.next.reset(old_table ? new table(*old_table) : new table);
+      }
     // check if type exists already first
-    if (info_list.count(tied_info->key()))
-      delete tied_info;
-    else
-      info_list[tied_info->key()] = tied_info;
+    if (r.next->by_key.count(tied_info->key()))
+      return;
+
+    r.next->by_key[tied_info->key()] = tied_info;
+    r.next->by_type[tied_info->type()] = tied_info;
+    r.infos.push_back(std::move(owned_info));
+    pending.store(true, memory_order_release);
   }
 
   /** 
@@ -401,22 +518,20 @@ struct InfoList
    *
    * @param obj pointer to a polymorphic object
    *
-   * @return Pointer to matching TiedInfoBase object in the list, or
-   * null pointer if none exists.
+   * @return Pointer to matching TiedInfoBase object in the list.
+   * @throw TypeNotRegisteredException if none exists.
    */
   template <class GivenType>
   static ptr_type get_matching_type(GivenType* obj)
   {
-    for (auto info_pair: info_list)
+    const table* types = published();
+    if (types)
       {
-	auto info_current = info_pair.second;
-	if (info_current->is_same_type(obj,typeid(*obj)))
-	  return info_current;
+	auto info_iter = types->by_type.find(type_index(typeid(*obj)));
+	if (info_iter != types->by_type.end())
+	  return info_iter->second;
       }
-
     throw TypeNotRegisteredException();
-    
-    return nullptr;		// from an earlier version
   }
 
   /** 
@@ -426,25 +541,80 @@ struct InfoList
    *
    * @param _key key to compare
    *
-   * @return Pointer to TiedInfoBase object with matching key, or null
-   * pointer if none exists in the list.
+   * @return Pointer to TiedInfoBase object with matching key.
+   * @throw TypeNotRegisteredException if none exists in the list.
+   */
+  static ptr_type get_matching_type_by_key(const string & _key)
+  {
+    ptr_type info = find_type_by_key(_key);
+
+    if (!info)
+      throw TypeNotRegisteredException(_key);
+
+    return info;
+  }
+
+  /** 
+   * The same as get_matching_type_by_key, but returns nullptr instead
+   * of throwing if no type has the key.
    */
-  static ptr_type get_matching_type_by_key(string _key)
+  static ptr_type find_type_by_key(const string & _key)
   {
-    auto info_iter = info_list.find(_key);
+    const table* types = published();
+    if (!types)
+      return nullptr;
+    auto info_iter = types->by_key.find(_key);
+    return info_iter == types->by_key.end() ? nullptr : info_iter->second;
+  }
 
-    if (info_iter == info_list.end())
+private:
+  /**
+   * Everything registered, and every table published, freed at the
+   * end of the program.
+   */
+  struct registry
+  {
+    mutex writing;		/**< held while registering */
+    vector<unique_ptr<TiedInfoBase<ReaderWriter> > > infos;
+    vector<unique_ptr<const table> > tables;
+    unique_ptr<table> next;	/**< with the types not published yet */
+  };
+
+  /**
+   * The table to look types up in, publishing the types registered
+   * since the last lookup first.
+   */
+  static const table* published()
+  {
+    if (pending.load(memory_order_acquire))
       {
-	throw TypeNotRegisteredException(_key);
-	return nullptr;
+	registry & r = owner();
+	lock_guard<mutex> lock(r.writing);
+	if (r.next)
+	  {
+	    r.tables.push_back(std::move(r.next));
+	    current.store(r.tables.back().get(), memory_order_release);
+	    pending.store(false, memory_order_release);
+	  }
       }
+    return current.load(memory_order_acquire);
+  }
 
-    return info_iter->second;
+  static registry & owner()
+  {
+    static registry r;
+    return r;
   }
+
+  static atomic<const table*> current; /**< latest table, or nullptr */
+  static atomic<bool> pending;	/**< whether types were registered since */
 };
 
 template <class ReaderWriter>
-map<string,TiedInfoBase<ReaderWriter>*> InfoList<ReaderWriter>::info_list = { };
+atomic<const typename InfoList<ReaderWriter>::table*> InfoList<ReaderWriter>::current{nullptr};
+
+template <class ReaderWriter>
+atomic<bool> InfoList<ReaderWriter>::pending{false};
 
 /** 
  * Registers a type by creating a
@@ -458,13 +628,27 @@ map<string,TiedInfoBase<ReaderWriter>*> InfoList<ReaderWriter>::info_list = { };
  * have different keys. The key then represents a unique identifier
  * for type T.
  *
+ * Registering is safe while other threads serialize (see InfoList).
+ *
  * @param readerwriter StreamReader/StreamWriter object
- * @param info pointer to an Info<T> object
+ * @param info Info<T> object
+ */
+template <class ReaderWriter, typename T>
+void register_type(ReaderWriter &, Info<T> info)
+{
+  // add_type deletes it if the type is registered already; looking
+  // the key up first would publish a table per type registered
+  InfoList<ReaderWriter>::add_type(new TiedInfo<ReaderWriter,T>(info));
+}
+
+/** 
+ * The same, from a pointer to an Info<T> object, which is copied; the
+ * caller keeps ownership of it.
  */
 template <class ReaderWriter, typename T>
 void register_type(ReaderWriter & readerwriter, Info<T>* info)
 {
-  InfoList<ReaderWriter>::add_type(new TiedInfo<ReaderWriter,T>(*info));
+  register_type(readerwriter, *info);
 }
 
 #endif // _TYPES_HPP